@@ -0,0 +1,234 @@
+#ifndef __AUTOSCALER_H__
+#define __AUTOSCALER_H__
+
+#include <hpx/hpx.hpp>
+#include <hpx/lcos/local/spinlock.hpp>
+//
+#include <boost/format.hpp>
+//
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+//
+// Scaling policy of rank 0. From the measured throughput of the working
+// localities and the repetitions left it estimates when the run finishes,
+// and asks for more nodes when that is after the deadline, or, without a
+// deadline, when the node budget allows a faster finish. Nodes take
+// 'startup' seconds from the request until they solve, so nothing is
+// requested when the run would be over before they arrive, and only one
+// request is outstanding at a time. Once no repetitions are left to issue
+// the added nodes are drained and their allocations released.
+//
+namespace spinsolver {
+
+    struct autoscale_input {
+        double      remaining   = 0;    // repetitions not yet completed
+        double      unissued    = 0;    // of which not yet issued
+        double      rate        = 0;    // repetitions/s of the working localities
+        std::size_t localities  = 0;    // working localities
+        std::size_t added       = 0;    // localities of requested allocations
+        std::size_t pending     = 0;    // requested nodes that have not connected
+        double      time_left   = -1;   // seconds to the deadline, <0 if none
+        double      budget_left = -1;   // node-seconds left to request, <0 if unlimited
+        double      startup     = 180;  // seconds from a request to a working node
+        std::size_t max_nodes   = 16;   // most localities to add
+    };
+
+    struct autoscale_decision {
+        int         add     = 0;        // nodes to request
+        int         minutes = 0;        // for this long
+        bool        drain   = false;    // give back the added nodes
+    };
+
+    inline autoscale_decision autoscale_policy(const autoscale_input &in)
+    {
+        autoscale_decision d;
+        if (in.added>0 && in.unissued==0) {
+            d.drain = true;
+            return d;
+        }
+        if (in.rate<=0 || in.localities==0 || in.pending>0) return d;
+        if (in.time_left<0 && in.budget_left<0) return d;
+        //
+        double per_node = in.rate/in.localities;
+        double finish   = in.remaining/in.rate;
+        // work left when requested nodes would start
+        double work     = in.remaining - in.rate*in.startup;
+        if (work<=0 || finish<1.5*in.startup) return d;
+        int room = static_cast<int>(in.max_nodes) - static_cast<int>(in.added);
+        if (room<=0) return d;
+        //
+        int want = 0;
+        if (in.time_left>=0) {
+            // 10% slack before the deadline
+            double usable = 0.9*in.time_left - in.startup;
+            if (usable<=0 || finish<=0.9*in.time_left) return d;
+            double need = work/usable;
+            want = static_cast<int>(std::ceil((need - in.rate)/per_node));
+        }
+        else {
+            // no deadline : as many nodes as the budget pays until the end
+            want = room;
+        }
+        want = (std::min)(want, room);
+        // node-seconds k added nodes cost until the run is over
+        auto cost = [&](int k) {
+            return k*(in.startup + work/(in.rate + k*per_node));
+        };
+        if (in.budget_left>=0) {
+            while (want>0 && cost(want)>in.budget_left) --want;
+        }
+        if (want<=0) return d;
+        // time until the run is over with the new nodes, 20% margin, at least 10 minutes
+        double seconds = 1.2*(in.startup + work/(in.rate + want*per_node));
+        d.add     = want;
+        d.minutes = (std::max)(10, static_cast<int>(std::ceil(seconds/60)));
+        return d;
+    }
+
+    //
+    // Applies the policy every interval seconds on rank 0. The callbacks
+    // measure the run, request nodes from the batch system and drain the
+    // added ones (returning how many were drained).
+    //
+    class autoscaler
+    {
+    public:
+        typedef std::function<autoscale_input()>    measure_function;
+        // requests nodes for minutes, returns the name of the allocation
+        typedef std::function<std::string(int, int)> request_function;
+        typedef std::function<int()>                drain_function;
+
+        autoscaler() : _stop(false), _requested(0), _connected(0) {}
+
+        // deadline in seconds from now (<0 none), budget in node-hours (<0 none)
+        void configure(double deadline, double budget, double startup, std::size_t max_nodes)
+        {
+            _deadline   = std::chrono::steady_clock::now() +
+                std::chrono::milliseconds(static_cast<int64_t>(1000*(std::max)(deadline, 0.0)));
+            _has_deadline = deadline>0;
+            _budget     = budget>0 ? budget*3600 : -1;
+            _startup    = startup;
+            _max_nodes  = max_nodes;
+        }
+
+        // blocks until stop(), call on its own thread
+        void run(measure_function measure, request_function request,
+                 drain_function drain, double interval)
+        {
+            while (hpx::is_running() && !_stop) {
+                autoscale_input in = measure();
+                {
+                    std::lock_guard<hpx::lcos::local::spinlock> lock(_mutex);
+                    in.pending     = pending();
+                    in.startup     = _startup;
+                    in.max_nodes   = _max_nodes;
+                    in.budget_left = _budget<0 ? -1 : (std::max)(_budget - _spent, 0.0);
+                    in.time_left   = !_has_deadline ? -1 : (std::max)(0.0,
+                        std::chrono::duration<double>(_deadline - std::chrono::steady_clock::now()).count());
+                }
+                autoscale_decision d = autoscale_policy(in);
+                // drain only when there was nothing to issue on two
+                // consecutive checks, not in a gap between two jobs
+                _drain_rounds = d.drain ? _drain_rounds + 1 : 0;
+                if (d.add>0) {
+                    std::cout << (boost::format("Autoscaler : %d repetitions at %.1f/s on %d localities, "
+                        "requesting %d nodes for %d minutes\n")
+                        % in.remaining % in.rate % in.localities % d.add % d.minutes);
+                    {
+                        std::lock_guard<hpx::lcos::local::spinlock> lock(_mutex);
+                        _requested += d.add;
+                        _spent += d.add*d.minutes*60.0;
+                        _request_time = std::chrono::steady_clock::now();
+                    }
+                    std::string name = request(d.add, d.minutes);
+                    std::lock_guard<hpx::lcos::local::spinlock> lock(_mutex);
+                    if (_failed.erase(name)) {
+                        drop(d.add);
+                    }
+                    else {
+                        _requests[name] = d.add;
+                    }
+                }
+                else if (d.drain && _drain_rounds>1) {
+                    int n = drain();
+                    if (n>0) std::cout << "Autoscaler : drained " << n << " localities" << std::endl;
+                }
+                hpx::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(1000*interval)));
+            }
+        }
+
+        void stop() { _stop = true; }
+
+        // a locality of a requested allocation connected, its delay updates
+        // the startup estimate
+        void connected()
+        {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(_mutex);
+            if (pending()==0) return;
+            double delay = std::chrono::duration<double>(std::chrono::steady_clock::now() - _request_time).count();
+            _startup = 0.5*_startup + 0.5*delay;
+            _connected++;
+        }
+
+        // an allocation could not be submitted, if it is one of ours its nodes
+        // are no longer waited for (any thread, also outside HPX)
+        void failed(const std::string &name)
+        {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(_mutex);
+            auto it = _requests.find(name);
+            if (it==_requests.end()) {
+                // the request call has not returned yet
+                _failed.insert(name);
+                return;
+            }
+            drop(it->second);
+            _requests.erase(it);
+        }
+
+    private:
+        // call with _mutex held, nodes of a request that will not connect
+        void drop(std::size_t nodes)
+        {
+            std::cout << "Autoscaler : request of " << nodes << " nodes failed" << std::endl;
+            _requested -= (std::min)(nodes, _requested - _connected);
+        }
+
+        // call with _mutex held. Requests the batch system has not started
+        // after four times the startup estimate are given up on.
+        std::size_t pending()
+        {
+            if (_requested>_connected &&
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - _request_time).count()>4*_startup) {
+                _connected = _requested;
+            }
+            return _requested - _connected;
+        }
+
+        std::atomic<bool>                       _stop;
+        hpx::lcos::local::spinlock              _mutex;
+        std::chrono::steady_clock::time_point   _deadline;
+        bool                                    _has_deadline = false;
+        double                                  _budget = -1;
+        double                                  _spent = 0;
+        double                                  _startup = 180;
+        std::size_t                             _max_nodes = 16;
+        std::size_t                             _requested;
+        std::size_t                             _connected;
+        int                                     _drain_rounds = 0;
+        // nodes of each of our requests, and failed requests not known yet
+        std::map<std::string, std::size_t>      _requests;
+        std::set<std::string>                   _failed;
+        std::chrono::steady_clock::time_point   _request_time;
+    };
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef __FAILURE_DETECTOR_H__
+#define __FAILURE_DETECTOR_H__
+
+#include <hpx/hpx.hpp>
+#include <hpx/lcos/local/spinlock.hpp>
+//
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <vector>
+
+namespace spinsolver {
+
+    // answered by every locality, an action that does nothing
+    inline int heartbeat() { return 1; }
+}
+
+HPX_PLAIN_ACTION(spinsolver::heartbeat, heartbeat_action);
+
+//
+// Heartbeats of the localities solving for rank 0. Every interval each
+// locality without a heartbeat in flight is sent one; a heartbeat that has
+// not returned within timeout(locality) seconds, or that fails, is a miss,
+// and a locality that misses max_misses heartbeats in a row is reported to
+// on_failure (once, on a new thread).
+//
+// HPX threads are not preempted, so on a locality whose cores are busy the
+// heartbeat waits behind the queued solve steps. The timeout is therefore
+// derived from the measured time between issuing a solve step and its result;
+// until that is known (timeout 0) a late heartbeat is not a miss, only a
+// failed one is.
+//
+class failure_detector
+{
+public:
+    typedef std::function<std::vector<hpx::id_type>()>      locality_source;
+    typedef std::function<double(const hpx::id_type&)>      timeout_source;
+    typedef std::function<void(const hpx::id_type&)>        failure_handler;
+
+    failure_detector() : _running(false), _interval(5000), _max_misses(3) {}
+
+    ~failure_detector() { stop(); }
+
+    void start(locality_source localities, timeout_source timeout, failure_handler on_failure,
+               boost::uint64_t interval_ms, int max_misses)
+    {
+        if (_running) return;
+        _localities = localities;
+        _timeout    = timeout;
+        _on_failure = on_failure;
+        _interval   = interval_ms;
+        _max_misses = (std::max)(max_misses, 1);
+        _running    = true;
+        _loop = hpx::async(&failure_detector::watch_loop, this);
+    }
+
+    // safe to call twice
+    void stop()
+    {
+        if (!_running.exchange(false)) return;
+        if (_loop.valid()) _loop.get();
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct watch {
+        hpx::future<int>    beat;
+        clock::time_point   sent;
+        int                 misses = 0;
+        bool                failed = false;
+    };
+
+    void watch_loop()
+    {
+        while (_running && hpx::is_running()) {
+            std::vector<hpx::id_type> localities = _localities();
+            // forget localities that are no longer solving
+            for (auto it = _watched.begin(); it!=_watched.end(); ) {
+                if (std::find(localities.begin(), localities.end(), it->first)==localities.end()) {
+                    it = _watched.erase(it);
+                }
+                else ++it;
+            }
+            for (auto &l : localities) {
+                check(l, _watched[l]);
+            }
+            hpx::this_thread::sleep_for(std::chrono::milliseconds(_interval));
+        }
+        _watched.clear();
+    }
+
+    void check(const hpx::id_type &l, watch &w)
+    {
+        if (w.failed) return;
+        bool missed = false;
+        if (w.beat.valid()) {
+            if (w.beat.is_ready()) {
+                if (w.beat.has_exception()) missed = true;
+                else w.misses = 0;
+                w.beat = hpx::future<int>();
+            }
+            else if (late(l, w)) {
+                // a late answer is not waited for
+                missed = true;
+                w.beat = hpx::future<int>();
+            }
+            else {
+                return;
+            }
+        }
+        if (missed && ++w.misses>=_max_misses) {
+            w.failed = true;
+            std::cout << "Locality " << hpx::naming::get_locality_id_from_id(l)
+                      << " missed " << w.misses << " heartbeats" << std::endl;
+            hpx::apply(_on_failure, l);
+            return;
+        }
+        w.sent = clock::now();
+        try {
+            w.beat = hpx::async(heartbeat_action(), l);
+        }
+        catch (std::exception &) {
+            // counted as a miss on the next check
+            w.beat = hpx::make_exceptional_future<int>(boost::current_exception());
+        }
+    }
+
+    bool late(const hpx::id_type &l, const watch &w)
+    {
+        double timeout = _timeout(l);
+        return timeout>0 && std::chrono::duration<double>(clock::now() - w.sent).count()>timeout;
+    }
+
+    std::atomic<bool>                   _running;
+    boost::uint64_t                     _interval;
+    int                                 _max_misses;
+    locality_source                     _localities;
+    timeout_source                      _timeout;
+    failure_handler                     _on_failure;
+    std::map<hpx::id_type, watch>       _watched;
+    hpx::future<void>                   _loop;
+};
+
+#endif
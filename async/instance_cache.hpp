@@ -0,0 +1,281 @@
+#ifndef __INSTANCE_CACHE_H__
+#define __INSTANCE_CACHE_H__
+
+#include <hpx/hpx.hpp>
+#include <hpx/lcos/local/spinlock.hpp>
+#include <hpx/runtime/serialization/serialize.hpp>
+#include <hpx/runtime/serialization/vector.hpp>
+#include <hpx/runtime/serialization/string.hpp>
+//
+#include <boost/format.hpp>
+//
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+//
+#include "hamiltonian.hpp"
+
+//
+// Content addressed cache of Hamiltonians on each locality.
+//
+// Instances are keyed by hamiltonian_type::content_hash(). A locality looks in
+// memory first, then (if a cache directory on a shared filesystem was set with
+// set_directory) for <dir>/<hash>.ham, so an instance loaded or received once
+// is never sent to that node again. Missing instances are pushed to the
+// localities that lack them along a binary tree: the root sends to two
+// localities, each of which forwards to two more, so the time to reach n
+// nodes grows with log(n) instead of n sends from rank 0.
+//
+// An instance stays in memory while it is pinned (by the solver wrappers
+// that registered it and by jobs that need it), of the others only the
+// capacity most recently used are kept. An evicted instance is read from
+// the cache directory again when it is needed.
+//
+namespace spinsolver { namespace instances {
+
+    typedef std::shared_ptr<const hamiltonian_type> instance_ptr;
+
+    struct cached_instance {
+        instance_ptr                        H;
+        int                                 pins = 0;
+        uint64_t                            used = 0;   // last use, for the LRU order
+    };
+
+    struct cache_type {
+        hpx::lcos::local::spinlock          mutex;
+        std::map<uint64_t, cached_instance> instances;
+        std::string                         directory;
+        std::size_t                         capacity = 8;
+        uint64_t                            clock = 0;
+    };
+
+    inline cache_type& cache() {
+        static cache_type c;
+        return c;
+    }
+
+    inline std::string cache_file(uint64_t hash) {
+        return cache().directory + "/" + (boost::format("%016x") % hash).str() + ".ham";
+    }
+
+    // use a (shared) directory as second level cache, empty to disable
+    inline void set_directory(const std::string &dir) {
+        cache().directory = dir;
+    }
+
+    // call with the cache mutex held : drop the least recently used unpinned
+    // instances beyond the capacity, never the one used last (so that an
+    // instance just stored can still be pinned)
+    inline void evict() {
+        cache_type &c = cache();
+        for (;;) {
+            std::size_t unpinned = 0;
+            auto oldest = c.instances.end();
+            for (auto it = c.instances.begin(); it!=c.instances.end(); ++it) {
+                if (it->second.pins>0) continue;
+                ++unpinned;
+                if (it->second.used==c.clock) continue;
+                if (oldest==c.instances.end() || it->second.used<oldest->second.used) oldest = it;
+            }
+            if (unpinned<=c.capacity || oldest==c.instances.end()) return;
+            c.instances.erase(oldest);
+        }
+    }
+
+    // call with the cache mutex held : the entry of an instance, marked used
+    inline cached_instance& insert(uint64_t hash, instance_ptr H) {
+        cached_instance &entry = cache().instances[hash];
+        if (!entry.H) entry.H = H;
+        entry.used = ++cache().clock;
+        return entry;
+    }
+
+    // the number of unpinned instances kept in memory
+    inline void set_capacity(std::size_t capacity) {
+        std::lock_guard<hpx::lcos::local::spinlock> lock(cache().mutex);
+        cache().capacity = capacity;
+        evict();
+    }
+
+    inline void write_file(const hamiltonian_type &H, uint64_t hash) {
+        if (cache().directory.empty()) return;
+        std::string file = cache_file(hash);
+        if (std::ifstream(file)) return;
+        std::vector<char> buffer;
+        {
+            hpx::serialization::output_archive archive(buffer);
+            archive << H;
+        }
+        // write and rename so that a reader never sees a partial file
+        std::string tmp = file + "." + std::to_string(hpx::get_locality_id()) + ".tmp";
+        std::ofstream(tmp, std::ios::binary).write(buffer.data(), buffer.size());
+        std::rename(tmp.c_str(), file.c_str());
+    }
+
+    inline instance_ptr read_file(uint64_t hash) {
+        if (cache().directory.empty()) return instance_ptr();
+        std::ifstream in(cache_file(hash), std::ios::binary);
+        if (!in) return instance_ptr();
+        std::vector<char> buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::shared_ptr<hamiltonian_type> H = std::make_shared<hamiltonian_type>();
+        hpx::serialization::input_archive archive(buffer, buffer.size());
+        archive >> *H;
+        return H;
+    }
+
+    // add an instance to this locality's cache unless it has one with the
+    // same hash, make() gives the instance to keep
+    template <typename Make>
+    inline uint64_t store(const hamiltonian_type &H, Make make) {
+        uint64_t hash = H.content_hash();
+        {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(cache().mutex);
+            auto it = cache().instances.find(hash);
+            if (it!=cache().instances.end()) {
+                it->second.used = ++cache().clock;
+                return hash;
+            }
+            insert(hash, make());
+            evict();
+        }
+        write_file(H, hash);
+        return hash;
+    }
+
+    // add a copy of an instance to this locality's cache, returns its hash
+    inline uint64_t store(const hamiltonian_type &H) {
+        return store(H, [&H]() { return std::make_shared<const hamiltonian_type>(H); });
+    }
+
+    // as above, the cache shares H instead of copying it
+    inline uint64_t store(instance_ptr H) {
+        return store(*H, [&H]() { return H; });
+    }
+
+    // the cached instance, or null if neither memory nor the directory have it
+    inline instance_ptr find(uint64_t hash) {
+        {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(cache().mutex);
+            auto it = cache().instances.find(hash);
+            if (it!=cache().instances.end()) {
+                it->second.used = ++cache().clock;
+                return it->second.H;
+            }
+        }
+        instance_ptr H = read_file(hash);
+        if (H && H->content_hash()==hash) {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(cache().mutex);
+            instance_ptr cached = insert(hash, H).H;
+            evict();
+            return cached;
+        }
+        return instance_ptr();
+    }
+
+    // keep an instance in memory until it is unpinned as often as it was
+    // pinned, false if neither memory nor the directory have it
+    inline bool pin(uint64_t hash) {
+        instance_ptr H = find(hash);
+        if (!H) return false;
+        std::lock_guard<hpx::lcos::local::spinlock> lock(cache().mutex);
+        ++insert(hash, H).pins;
+        return true;
+    }
+
+    inline void unpin(uint64_t hash) {
+        std::lock_guard<hpx::lcos::local::spinlock> lock(cache().mutex);
+        auto it = cache().instances.find(hash);
+        if (it==cache().instances.end() || it->second.pins==0) return;
+        --it->second.pins;
+        evict();
+    }
+
+    inline instance_ptr get(uint64_t hash) {
+        instance_ptr H = find(hash);
+        if (!H) {
+            throw std::runtime_error("instance " + (boost::format("%016x") % hash).str()
+                + " is not in the cache of this locality");
+        }
+        return H;
+    }
+
+    // cache the instance made by applying a delta to a cached one, returns
+    // its hash (the same on every locality)
+    inline uint64_t apply_delta(uint64_t base, const hamiltonian_delta &delta) {
+        hamiltonian_type H(*get(base));
+        H.apply(delta);
+        return store(H);
+    }
+
+    // so the root can skip localities that already hold an instance
+    inline bool has_instance(uint64_t hash) {
+        return static_cast<bool>(find(hash));
+    }
+}}
+
+HPX_PLAIN_ACTION(spinsolver::instances::has_instance, has_instance_action);
+
+namespace spinsolver { namespace instances {
+
+    inline int receive_instance(const hamiltonian_type &H, std::vector<hpx::id_type> subtree);
+
+}}
+
+HPX_PLAIN_ACTION(spinsolver::instances::receive_instance, receive_instance_action);
+
+namespace spinsolver { namespace instances {
+
+    // send H to the heads of the two halves of targets, each head forwards
+    // it to the rest of its half
+    inline hpx::future<void> forward(const hamiltonian_type &H, const std::vector<hpx::id_type> &targets) {
+        std::vector<hpx::future<int>> sent;
+        std::size_t half = (targets.size() + 1)/2;
+        for (std::size_t begin : {std::size_t(0), half}) {
+            std::size_t end = begin==0 ? half : targets.size();
+            if (begin>=end) continue;
+            std::vector<hpx::id_type> subtree(targets.begin() + begin + 1, targets.begin() + end);
+            sent.push_back(hpx::async(receive_instance_action(), targets[begin], H, subtree));
+        }
+        return hpx::when_all(sent).then(hpx::launch::sync,
+            [](hpx::future<std::vector<hpx::future<int>>> f) {
+                for (auto &s : f.get()) s.get();
+            });
+    }
+
+    // an inner node of the broadcast tree, returns when its subtree has H
+    inline int receive_instance(const hamiltonian_type &H, std::vector<hpx::id_type> subtree) {
+        store(H);
+        if (!subtree.empty()) forward(H, subtree).get();
+        return 1;
+    }
+
+    // make sure every locality has the instance, sending it only to those
+    // that lack it
+    inline hpx::future<void> distribute(instance_ptr H, uint64_t hash,
+                                        const std::vector<hpx::id_type> &localities) {
+        std::vector<hpx::future<bool>> present;
+        for (auto &l : localities) {
+            present.push_back(hpx::async(has_instance_action(), l, hash));
+        }
+        return hpx::when_all(present).then(
+            [H, hash, localities](hpx::future<std::vector<hpx::future<bool>>> f) {
+                std::vector<hpx::future<bool>> p = f.get();
+                std::vector<hpx::id_type> missing;
+                for (std::size_t i=0; i<p.size(); ++i) {
+                    if (!p[i].get()) missing.push_back(localities[i]);
+                }
+                if (!missing.empty()) {
+                    std::cout << (boost::format("Sending instance %016x to %d of %d localities\n")
+                        % hash % missing.size() % localities.size());
+                    forward(*H, missing).get();
+                }
+            });
+    }
+}}
+
+#endif
@@ -0,0 +1,514 @@
+#ifndef __JOB_SERVICE_H__
+#define __JOB_SERVICE_H__
+
+#include <hpx/hpx.hpp>
+#include <hpx/lcos/local/spinlock.hpp>
+//
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+//
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <vector>
+//
+#include "hamiltonian.hpp"
+#include "result.hpp"
+#include "sa_solver.hpp"
+#include "solver_wrapper.hpp"
+#include "instance_cache.hpp"
+#include "warm_start.hpp"
+
+//
+// A job for the solver service, read from a file <queue>/<id>.job of
+// key=value lines, e.g.
+//    input=/scratch/instances/1024random3.lat
+//    Ns=5000
+//    repetitions=2000
+//    priority=10
+// missing keys take the defaults below, # starts a comment.
+//
+// Instead of an input a job can name a finished job as its base, e.g.
+//    base=step41
+//    delta=/scratch/edits/step42.txt
+//    Ns=200
+// It solves the instance of the base job with the terms of the delta file
+// changed ("site site value" lines, 0 removes a term) and starts its runs
+// from the best configurations of the base job at beta warm-beta.
+//
+struct job_spec {
+    std::string  id;
+    std::string  input;
+    std::string  base;          // finished job to start from instead of an input
+    std::string  delta;         // changed terms applied to the instance of base
+    std::string  output;        // default <queue>/done/<id>.out
+    uint64_t     Ns          = 1000;
+    uint64_t     repetitions = 1000;
+    double       beta0       = 0.1;
+    double       beta1       = 3.0;
+    int          priority    = 0;   // higher runs first
+    uint64_t     order       = 0;   // submission order, earlier runs first
+    spin_format  format      = spin_format::internal;
+    // warm start of a job with a base : its best configurations used, the
+    // beta0 of the runs and the fraction of spins flipped before each run
+    std::size_t  warm_top       = 16;
+    double       warm_beta      = 1.0;
+    double       warm_randomise = 0.0;
+
+    static job_spec read(const boost::filesystem::path &file) {
+        job_spec job;
+        job.id = file.stem().string();
+        std::ifstream in(file.string());
+        std::string line;
+        while (std::getline(in, line)) {
+            line = line.substr(0, line.find('#'));
+            std::size_t eq = line.find('=');
+            if (eq==std::string::npos) continue;
+            std::string key   = boost::algorithm::trim_copy(line.substr(0, eq));
+            std::string value = boost::algorithm::trim_copy(line.substr(eq+1));
+            if      (key=="input")       job.input       = value;
+            else if (key=="output")      job.output      = value;
+            else if (key=="Ns")          job.Ns          = boost::lexical_cast<uint64_t>(value);
+            else if (key=="repetitions") job.repetitions = boost::lexical_cast<uint64_t>(value);
+            else if (key=="beta0")       job.beta0       = boost::lexical_cast<double>(value);
+            else if (key=="beta1")       job.beta1       = boost::lexical_cast<double>(value);
+            else if (key=="priority")    job.priority    = boost::lexical_cast<int>(value);
+            else if (key=="spin-format") job.format      = parse_spin_format(value);
+            else if (key=="base")        job.base        = value;
+            else if (key=="delta")       job.delta       = value;
+            else if (key=="warm-top")    job.warm_top    = boost::lexical_cast<std::size_t>(value);
+            else if (key=="warm-beta")   job.warm_beta   = boost::lexical_cast<double>(value);
+            else if (key=="warm-randomise") job.warm_randomise = boost::lexical_cast<double>(value);
+            else throw std::invalid_argument("unknown job key '" + key + "'");
+        }
+        if (job.input.empty()==job.base.empty()) throw std::invalid_argument("job needs either an input or a base");
+        if (!job.delta.empty() && job.base.empty()) throw std::invalid_argument("a delta needs a base job");
+        return job;
+    }
+
+    bool operator<(const job_spec &other) const {
+        // std::priority_queue pops the largest
+        if (priority!=other.priority) return priority<other.priority;
+        return order>other.order;
+    }
+};
+
+//
+// Keeps the localities and runtime alive between problems: polls a queue
+// directory for *.job files and runs up to max_jobs of them at the same time,
+// highest priority first. The Hamiltonian of a job is registered as an
+// instance with the solver wrapper of every ready locality and a master of
+// its own issues the solve steps, so jobs on different instances share the
+// nodes and a small job fills the threads a large one leaves idle.
+// A job file moves through
+//    <queue>/<id>.job -> running/ -> done/  (results in done/<id>.out)
+//                                 -> failed/ (reason in failed/<id>.err)
+// The service drains (finishes running jobs, starts no new ones) when stop()
+// is called or a file named "stop" appears in the queue directory.
+// The masters of running jobs are listed by masters() so that a locality that
+// is scaled down can be drained from all of them.
+// The instance and best configurations of the last finished jobs are kept for
+// jobs that name them as base : the localities that cache the base instance
+// only receive the delta. The warm start of a job is kept by the workers
+// under the instance and a key of the job, its steps name both.
+//
+class job_service
+{
+public:
+    typedef wrapped_solver_class<sa_solver> wrapper_type;
+    typedef std::function<std::vector<hpx::id_type>()> worker_source;
+    typedef std::shared_ptr<wrapper_type> master_ptr;
+
+    job_service() : _stop(false), _active(false), _max_jobs(1), _poll(1000), _submitted(0),
+        _idle_since(std::chrono::steady_clock::now()) {}
+
+    // blocks until the service has been stopped and all running jobs finished
+    // workers() returns the solver wrappers of the ready localities
+    void run(const std::string &queue, worker_source workers,
+             std::size_t max_jobs, boost::uint64_t poll_ms)
+    {
+        namespace fs = boost::filesystem;
+        _queue      = queue;
+        _workers    = workers;
+        _max_jobs   = (std::max)(max_jobs, std::size_t(1));
+        _poll       = poll_ms;
+        for (const char *d : {"running", "done", "failed"}) {
+            fs::create_directories(_queue / d);
+        }
+        std::cout << "Solver service waiting for jobs in " << _queue.string() << std::endl;
+        _active = true;
+
+        std::vector<hpx::future<void>> running;
+        while (hpx::is_running()) {
+            if (fs::exists(_queue / "stop")) _stop = true;
+            if (!_stop) claim_new_jobs();
+            // forget finished jobs and start pending ones in priority order
+            running.erase(std::remove_if(running.begin(), running.end(),
+                [](hpx::future<void> &f) { return f.is_ready(); }), running.end());
+            while (!_stop && running.size()<_max_jobs && !_pending.empty()) {
+                job_spec job = _pending.top();
+                _pending.pop();
+                running.push_back(hpx::async(&job_service::run_job, this, job));
+            }
+            if (_stop && running.empty()) break;
+            hpx::this_thread::sleep_for(std::chrono::milliseconds(_poll));
+        }
+        // jobs that were claimed but not started go back to the queue
+        while (!_pending.empty()) {
+            const job_spec &job = _pending.top();
+            fs::rename(_queue / "running" / (job.id + ".job"), _queue / (job.id + ".job"));
+            _pending.pop();
+        }
+        _active = false;
+        std::cout << "Solver service stopped" << std::endl;
+    }
+
+    void stop() { _stop = true; }
+
+    // true while run() serves the queue
+    bool active() const { return _active; }
+
+    // seconds since the last job finished, 0 while jobs are running
+    double idle_seconds() {
+        std::lock_guard<hpx::lcos::local::spinlock> lock(_master_mutex);
+        if (!_masters.empty()) return 0;
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - _idle_since).count();
+    }
+
+    // the masters of the running jobs
+    std::vector<master_ptr> masters() {
+        std::lock_guard<hpx::lcos::local::spinlock> lock(_master_mutex);
+        return std::vector<master_ptr>(_masters.begin(), _masters.end());
+    }
+
+private:
+    // move new job files to running/ and queue them
+    void claim_new_jobs()
+    {
+        namespace fs = boost::filesystem;
+        std::vector<fs::path> files;
+        for (fs::directory_iterator it(_queue), end; it!=end; ++it) {
+            if (fs::is_regular_file(it->path()) && it->path().extension()==".job") {
+                files.push_back(it->path());
+            }
+        }
+        // oldest first so that equal priorities run in submission order
+        std::sort(files.begin(), files.end(), [](const fs::path &a, const fs::path &b) {
+            return fs::last_write_time(a)<fs::last_write_time(b);
+        });
+        for (auto &file : files) {
+            fs::path claimed = _queue / "running" / file.filename();
+            fs::rename(file, claimed);
+            try {
+                job_spec job = job_spec::read(claimed);
+                job.order = _submitted++;
+                if (job.output.empty()) {
+                    job.output = (_queue / "done" / (job.id + ".out")).string();
+                }
+                _pending.push(job);
+            }
+            catch (std::exception &e) {
+                fail(claimed.stem().string(), e.what());
+            }
+        }
+    }
+
+    void run_job(job_spec job)
+    {
+        namespace fs = boost::filesystem;
+        try {
+            std::cout << "Starting job " << job.id << " priority " << job.priority
+                      << " input " << (job.base.empty() ? job.input : "job " + job.base) << std::endl;
+            uint64_t instance;
+            uint64_t base_instance = 0;
+            hamiltonian_delta delta;
+            warm_start warm;
+            double beta0 = job.beta0;
+            if (job.base.empty()) {
+                hamiltonian_type input(job.input);
+                if (input.size()==0) throw std::runtime_error("cannot read input " + job.input);
+                instance = spinsolver::instances::store(input);
+            }
+            else {
+                finished_job base = finished(job.base);
+                if (!job.delta.empty()) {
+                    std::ifstream in(job.delta);
+                    if (!in) throw std::runtime_error("cannot read delta " + job.delta);
+                    delta = hamiltonian_delta(in);
+                }
+                base_instance = base.instance;
+                instance = spinsolver::instances::apply_delta(base_instance, delta);
+                job.input = base.input;
+                warm = base.best;
+                if (job.warm_top>0 && warm.states.size()>job.warm_top) warm.states.resize(job.warm_top);
+                warm.randomise = job.warm_randomise;
+                beta0 = job.warm_beta;
+            }
+            // kept in the cache of this locality while the job runs
+            if (!spinsolver::instances::pin(instance)) {
+                throw std::runtime_error("instance of job " + job.id + " is no longer cached");
+            }
+            std::shared_ptr<void> pinned(nullptr,
+                [=](void*) { spinsolver::instances::unpin(instance); });
+            spinsolver::instances::instance_ptr H = spinsolver::instances::get(instance);
+
+            // register the instance with the solver wrapper of every ready
+            // locality, jobs on the same instance share the registration
+            std::vector<hpx::id_type> workers = _workers();
+            acquire(instance, workers, base_instance, delta);
+            // (released when the job ends, also when it fails)
+            std::shared_ptr<void> registration(nullptr,
+                [=](void*) { this->release(instance, workers); });
+
+            // a master of our own for the spawn loop of this job
+            hpx::id_type master_id = hpx::components::new_<wrapper_type>(hpx::find_here()).get();
+            master_ptr wrapper = hpx::get_ptr_sync<wrapper_type>(master_id);
+            wrapper->setSolverIds(workers);
+            wrapper->setInstance(instance);
+            // the submission order is unique among the jobs of this service
+            const uint64_t warm_key = job.order + 1;
+            wrapper->setWarmStartKey(warm_key);
+            {
+                std::lock_guard<hpx::lcos::local::spinlock> lock(_master_mutex);
+                _masters.insert(wrapper);
+            }
+            std::shared_ptr<void> listed(nullptr, [=](void*) {
+                std::lock_guard<hpx::lcos::local::spinlock> lock(this->_master_mutex);
+                this->_masters.erase(wrapper);
+                this->_idle_since = std::chrono::steady_clock::now();
+            });
+
+            // a cold job adds none, its steps find no warm start for its key
+            std::shared_ptr<void> warmed_up;
+            if (!warm.empty()) {
+                std::vector<hpx::future<void>> warmed;
+                for (auto &w : workers) {
+                    warmed.push_back(hpx::async(wrapper_type::add_warm_start_action(), w, instance, warm_key, warm));
+                }
+                warmed_up = std::shared_ptr<void>(nullptr, [=](void*) {
+                    for (auto &w : workers) {
+                        hpx::apply(wrapper_type::remove_warm_start_action(), w, instance, warm_key);
+                    }
+                });
+                hpx::wait_all(warmed);
+                for (auto &w : warmed) w.get();
+            }
+
+            // same argument types as the command line run so that the same
+            // run_one action is used
+            const double beta1  = job.beta1;
+            const uint64_t Ns   = job.Ns;
+            wrapper_type::result_type results = wrapper->spawn(job.repetitions, beta0, beta1, Ns);
+
+            std::ofstream out(job.output);
+            out << "# infile=" + job.input
+                + (job.base.empty() ? "" : " base=" + job.base)
+                + (job.delta.empty() ? "" : " delta=" + job.delta)
+                + " Ns=" + std::to_string(Ns)
+                + " beta0=" + std::to_string(beta0)
+                + " beta1=" + std::to_string(beta1)
+                + " num_rep=" + std::to_string(job.repetitions)
+                + " spin_format=" + to_string(job.format)
+                << std::endl;
+            result_writer writer(*H, job.format);
+            for (auto &r : results) {
+                writer(out, r);
+            }
+            remember(job.id, job.input, instance, results);
+            fs::rename(_queue / "running" / (job.id + ".job"), _queue / "done" / (job.id + ".job"));
+            std::cout << "Finished job " << job.id << " -> " << job.output << std::endl;
+        }
+        catch (std::exception &e) {
+            fail(job.id, e.what());
+        }
+    }
+
+    // add a cached instance to the workers unless a running job already did:
+    // the instance goes to the instance cache of the worker localities that
+    // lack it, then each wrapper registers it from there. An instance made
+    // from a base instance and a delta is made by the localities caching the
+    // base themselves.
+    void acquire(uint64_t instance, const std::vector<hpx::id_type> &workers,
+                 uint64_t base, const hamiltonian_delta &delta)
+    {
+        std::vector<hpx::future<hpx::id_type>> located;
+        for (auto &w : workers) {
+            located.push_back(hpx::get_colocation_id(w));
+        }
+        std::vector<hpx::id_type> localities = hpx::util::unwrapped(located);
+        hpx::shared_future<void> registered;
+        {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(_instance_mutex);
+            instance_use &use = _instance_users[instance];
+            if (use.jobs++ == 0) {
+                use.registered = base!=0 && base!=instance ?
+                    register_delta(instance, base, delta, localities, workers) :
+                    register_instance(instance, localities, workers);
+            }
+            registered = use.registered;
+        }
+        // a second job on the instance waits for the first job's registration.
+        // If it failed the job fails, the next job on the instance tries
+        // again once no job uses it.
+        try {
+            registered.get();
+        }
+        catch (...) {
+            release(instance, workers);
+            throw;
+        }
+    }
+
+    static hpx::future<void> register_instance(uint64_t instance,
+        const std::vector<hpx::id_type> &localities, const std::vector<hpx::id_type> &workers)
+    {
+        return spinsolver::instances::distribute(
+            spinsolver::instances::get(instance), instance, localities).then(
+            [instance, workers](hpx::future<void> f) {
+                f.get();
+                std::vector<hpx::future<uint64_t>> added;
+                for (auto &w : workers) {
+                    added.push_back(hpx::async(wrapper_type::add_instance_action(), w, instance));
+                }
+                // every wrapper must have it, a failed one fails the registration
+                hpx::wait_all(added);
+                for (auto &a : added) {
+                    if (a.get()!=instance) throw std::runtime_error("a locality registered a different instance");
+                }
+            });
+    }
+
+    // workers on localities that cache the base get the delta, the others
+    // the whole instance
+    static hpx::future<void> register_delta(uint64_t instance, uint64_t base, const hamiltonian_delta &delta,
+        const std::vector<hpx::id_type> &localities, const std::vector<hpx::id_type> &workers)
+    {
+        std::vector<hpx::future<bool>> present;
+        for (auto &l : localities) {
+            present.push_back(hpx::async(has_instance_action(), l, base));
+        }
+        return hpx::when_all(present).then(
+            [instance, base, delta, localities, workers](hpx::future<std::vector<hpx::future<bool>>> f) {
+                std::vector<hpx::future<bool>> p = f.get();
+                std::vector<hpx::id_type> missing, missing_workers;
+                std::vector<hpx::future<uint64_t>> added;
+                for (std::size_t i=0; i<p.size(); ++i) {
+                    if (p[i].get()) {
+                        added.push_back(hpx::async(wrapper_type::add_delta_instance_action(), workers[i], base, delta));
+                    }
+                    else {
+                        missing.push_back(localities[i]);
+                        missing_workers.push_back(workers[i]);
+                    }
+                }
+                hpx::future<void> whole = missing.empty() ? hpx::make_ready_future() :
+                    register_instance(instance, missing, missing_workers);
+                hpx::wait_all(added);
+                whole.get();
+                for (auto &a : added) {
+                    if (a.get()!=instance) throw std::runtime_error("a locality made a different instance from the delta");
+                }
+            });
+    }
+
+    // the last job on an instance removes it from the workers
+    void release(uint64_t instance, const std::vector<hpx::id_type> &workers)
+    {
+        {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(_instance_mutex);
+            if (--_instance_users[instance].jobs > 0) return;
+            _instance_users.erase(instance);
+        }
+        for (auto &w : workers) {
+            hpx::apply(wrapper_type::remove_instance_action(), w, instance);
+        }
+    }
+
+    struct finished_job {
+        std::string     input;
+        uint64_t        instance = 0;
+        warm_start      best;
+    };
+
+    // keep the instance and best configurations of a finished job for jobs
+    // that name it as base, the oldest are forgotten. The instance stays
+    // pinned in the cache of this locality until then, jobs on a delta make
+    // their instance from it.
+    void remember(const std::string &id, const std::string &input, uint64_t instance,
+                  const wrapper_type::result_type &results)
+    {
+        finished_job job;
+        job.input    = input;
+        job.instance = instance;
+        job.best     = make_warm_start(results, 64);
+        spinsolver::instances::pin(instance);
+        std::vector<uint64_t> forgotten;
+        {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(_finished_mutex);
+            auto it = _finished.find(id);
+            if (it==_finished.end()) {
+                _finished_order.push_back(id);
+            }
+            else {
+                forgotten.push_back(it->second.instance);
+            }
+            _finished[id] = job;
+            while (_finished_order.size()>64) {
+                forgotten.push_back(_finished[_finished_order.front()].instance);
+                _finished.erase(_finished_order.front());
+                _finished_order.pop_front();
+            }
+        }
+        for (uint64_t f : forgotten) spinsolver::instances::unpin(f);
+    }
+
+    finished_job finished(const std::string &id)
+    {
+        std::lock_guard<hpx::lcos::local::spinlock> lock(_finished_mutex);
+        auto it = _finished.find(id);
+        if (it==_finished.end()) throw std::runtime_error("base job " + id + " has not finished");
+        return it->second;
+    }
+
+    void fail(const std::string &id, const std::string &reason)
+    {
+        namespace fs = boost::filesystem;
+        std::cout << "Job " << id << " failed : " << reason << std::endl;
+        std::ofstream(( _queue / "failed" / (id + ".err")).string()) << reason << std::endl;
+        boost::system::error_code ec;
+        fs::rename(_queue / "running" / (id + ".job"), _queue / "failed" / (id + ".job"), ec);
+    }
+
+    std::atomic<bool>               _stop;
+    std::atomic<bool>               _active;
+    std::size_t                     _max_jobs;
+    boost::uint64_t                 _poll;
+    uint64_t                        _submitted;
+    boost::filesystem::path         _queue;
+    worker_source                   _workers;
+    std::priority_queue<job_spec>   _pending;
+    hpx::lcos::local::spinlock      _instance_mutex;
+    struct instance_use {
+        int                         jobs = 0;
+        hpx::shared_future<void>    registered;
+    };
+    std::map<uint64_t, instance_use> _instance_users;
+    hpx::lcos::local::spinlock      _master_mutex;
+    std::set<master_ptr>            _masters;
+    hpx::lcos::local::spinlock      _finished_mutex;
+    std::map<std::string, finished_job> _finished;
+    std::deque<std::string>         _finished_order;
+    std::chrono::steady_clock::time_point _idle_since;
+};
+
+#endif
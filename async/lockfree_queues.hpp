@@ -0,0 +1,170 @@
+#ifndef __LOCKFREE_QUEUES_H__
+#define __LOCKFREE_QUEUES_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+//
+// Queues used by the scheduler of the solver wrapper to pass work between
+// threads without taking a lock. Neither blocks: pop returns false when the
+// queue is empty (and push on a full ring returns false), the caller decides
+// whether to yield or poll again later. The membership of the scheduler is a
+// copy-on-write list that readers follow without a lock.
+//
+namespace spinsolver { namespace lockfree {
+
+    // keep the producer and consumer indices on different cache lines
+    static const std::size_t cache_line_size = 64;
+
+    //
+    // Bounded ring for one producer thread and one consumer thread. The
+    // capacity is rounded up to a power of two.
+    //
+    template <typename T>
+    class spsc_ring
+    {
+    public:
+        explicit spsc_ring(std::size_t capacity) : _head(0), _tail(0) {
+            std::size_t n = 1;
+            while (n<capacity) n <<= 1;
+            _buffer.resize(n);
+            _mask = n - 1;
+        }
+
+        // producer only, false if the ring is full
+        bool push(T value) {
+            std::size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head.load(std::memory_order_acquire) > _mask) return false;
+            _buffer[tail & _mask] = std::move(value);
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer only, false if the ring is empty
+        bool pop(T &value) {
+            std::size_t head = _head.load(std::memory_order_relaxed);
+            if (head==_tail.load(std::memory_order_acquire)) return false;
+            value = std::move(_buffer[head & _mask]);
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // a snapshot, exact only when called from the producer or consumer
+        // while the other side is idle
+        std::size_t size() const {
+            return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+        }
+
+        std::size_t capacity() const { return _mask + 1; }
+
+    private:
+        std::vector<T>              _buffer;
+        std::size_t                 _mask;
+        char                        _pad0[cache_line_size];
+        std::atomic<std::size_t>    _head;
+        char                        _pad1[cache_line_size];
+        std::atomic<std::size_t>    _tail;
+        char                        _pad2[cache_line_size];
+    };
+
+    //
+    // Unbounded queue for any number of producers and one consumer
+    // (D. Vyukov's intrusive MPSC queue). A push is one exchange on the
+    // shared head, producers never wait for each other or for the consumer.
+    // A pop may miss an item whose push has not finished linking it in; it
+    // is returned by a later pop.
+    //
+    template <typename T>
+    class mpsc_queue
+    {
+        struct node {
+            std::atomic<node*>  next;
+            T                   value;
+            node() : next(nullptr) {}
+            explicit node(T &&v) : next(nullptr), value(std::move(v)) {}
+        };
+
+    public:
+        mpsc_queue() : _head(new node()), _tail(_head.load()) {}
+
+        ~mpsc_queue() {
+            T value;
+            while (pop(value)) {}
+            delete _tail;
+        }
+
+        mpsc_queue(const mpsc_queue&) = delete;
+        mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+        // any thread
+        void push(T value) {
+            node *n = new node(std::move(value));
+            node *prev = _head.exchange(n, std::memory_order_acq_rel);
+            prev->next.store(n, std::memory_order_release);
+        }
+
+        // consumer only, false if the queue is (or appears) empty
+        bool pop(T &value) {
+            node *next = _tail->next.load(std::memory_order_acquire);
+            if (!next) return false;
+            value = std::move(next->value);
+            delete _tail;
+            _tail = next;
+            return true;
+        }
+
+    private:
+        std::atomic<node*>          _head;
+        char                        _pad[cache_line_size];
+        node                       *_tail;
+    };
+
+    //
+    // A list that is never modified once published: writers (serialised by
+    // the caller) publish a new one, which bumps the epoch. Readers keep their
+    // snapshot, which stays valid while they hold it, and reload it when they
+    // see a new epoch.
+    //
+    template <typename T>
+    class cow_list
+    {
+    public:
+        typedef std::vector<T> list_type;
+
+        cow_list() : _list(std::make_shared<const list_type>()), _epoch(0) {}
+
+        std::shared_ptr<const list_type> snapshot() const {
+            return std::atomic_load(&_list);
+        }
+
+        // the list is stored before the epoch changes, so a reader that sees
+        // the new epoch loads the new list (or a later one)
+        void publish(std::shared_ptr<const list_type> list) {
+            std::atomic_store(&_list, list);
+            _epoch.fetch_add(1, std::memory_order_acq_rel);
+        }
+
+        uint64_t epoch() const { return _epoch.load(std::memory_order_acquire); }
+
+        // reload a reader's snapshot if the epoch changed since it was taken,
+        // epoch starts as ~0 for a reader without one
+        bool refresh(std::shared_ptr<const list_type> &list, uint64_t &epoch) const {
+            uint64_t now = this->epoch();
+            if (now==epoch && list) return false;
+            epoch = now;
+            list  = snapshot();
+            return true;
+        }
+
+    private:
+        std::shared_ptr<const list_type>    _list;
+        std::atomic<uint64_t>               _epoch;
+    };
+
+}}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef __NUMA_PLACEMENT_H__
+#define __NUMA_PLACEMENT_H__
+
+#include <hpx/hpx.hpp>
+#include <hpx/runtime/threads/topology.hpp>
+//
+#include <boost/lexical_cast.hpp>
+//
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//
+// The NUMA domains of the worker threads of this locality, as placed by the
+// HPX affinity options (--hpx:bind, --hpx:pu-offset, ...), and an executor
+// that runs a task on a worker thread of a given domain.
+//
+// Work scheduled with async_on_domain is put on the queue of one of the
+// domain's threads (round robin). Run with --hpx:numa-sensitive so that idle
+// threads do not steal it across domains. Placement can be switched off
+// with -Ispinsolve.numa_placement=0, and is off if there is only one domain.
+//
+namespace spinsolver { namespace numa {
+
+    struct domains_type {
+        // worker threads of each domain, and domain of each worker thread
+        std::vector<std::vector<std::size_t>>   threads;
+        std::vector<std::size_t>                domain_of;
+        std::unique_ptr<std::atomic<std::size_t>[]> next;
+        bool                                    enabled;
+
+        domains_type() {
+            hpx::threads::topology const &topo = hpx::threads::get_topology();
+            std::size_t n = hpx::get_os_thread_count();
+            for (std::size_t t=0; t<n; ++t) {
+                std::size_t d = topo.get_numa_node_number(t);
+                if (d>=threads.size()) threads.resize(d+1);
+                threads[d].push_back(t);
+                domain_of.push_back(d);
+            }
+            // drop domains without worker threads, renumbering the others
+            std::vector<std::size_t> renumber(threads.size());
+            std::vector<std::vector<std::size_t>> used;
+            for (std::size_t d=0; d<threads.size(); ++d) {
+                renumber[d] = used.size();
+                if (!threads[d].empty()) used.push_back(threads[d]);
+            }
+            for (auto &d : domain_of) d = renumber[d];
+            threads.swap(used);
+            next.reset(new std::atomic<std::size_t>[threads.size()]);
+            for (std::size_t d=0; d<threads.size(); ++d) next[d] = 0;
+            enabled = threads.size()>1 &&
+                hpx::get_config_entry("spinsolve.numa_placement", "1")!="0";
+        }
+
+        std::size_t size() const { return enabled ? threads.size() : 1; }
+
+        // domain of the calling worker thread
+        std::size_t current() const {
+            if (!enabled) return 0;
+            std::size_t t = hpx::get_worker_thread_num();
+            return t<domain_of.size() ? domain_of[t] : 0;
+        }
+
+        // e.g. "2 NUMA domains, threads 0:[0-7] 1:[8-15], placement on"
+        std::string describe() const {
+            std::ostringstream os;
+            os << threads.size() << " NUMA domain" << (threads.size()==1 ? "" : "s") << ", threads";
+            for (std::size_t d=0; d<threads.size(); ++d) {
+                os << " " << d << ":[" << threads[d].front();
+                if (threads[d].size()>1) os << "-" << threads[d].back();
+                os << "]";
+            }
+            os << ", placement " << (enabled ? "on" : "off");
+            return os.str();
+        }
+    };
+
+    inline domains_type& domains() {
+        static domains_type d;
+        return d;
+    }
+
+    // run f on a worker thread of the domain, returns its result
+    template <typename F>
+    hpx::future<typename std::result_of<F()>::type> async_on_domain(std::size_t domain, F && f)
+    {
+        typedef typename std::result_of<F()>::type result_type;
+        domains_type &d = domains();
+        if (!d.enabled) {
+            return hpx::async(std::forward<F>(f));
+        }
+        std::vector<std::size_t> const &threads = d.threads[domain];
+        std::size_t os_thread = threads[d.next[domain]++ % threads.size()];
+        //
+        std::shared_ptr<hpx::lcos::local::promise<result_type>> p =
+            std::make_shared<hpx::lcos::local::promise<result_type>>();
+        hpx::future<result_type> result = p->get_future();
+        hpx::applier::register_thread_nullary(
+            [p, f]() mutable {
+                try {
+                    p->set_value(f());
+                }
+                catch (...) {
+                    p->set_exception(boost::current_exception());
+                }
+            },
+            "async_on_domain",
+            hpx::threads::pending, true, hpx::threads::thread_priority_normal,
+            os_thread, hpx::threads::thread_stacksize_default);
+        return result;
+    }
+
+}}
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef __PORTFOLIO_H__
+#define __PORTFOLIO_H__
+
+#include <hpx/hpx.hpp>
+//
+#include <boost/format.hpp>
+//
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+//
+#include "result.hpp"
+#include "solver_wrapper.hpp"
+
+//
+// Races several solver engines (masters of different wrapper types) on one
+// instance. Every engine spawns on all localities with a share of their
+// cores, equal at the start. Every interval the engine holding the best
+// energy (the first to reach it on a tie) takes up to 'step' of the share of
+// each other engine, which keeps at least 'min_share'; the share of an
+// engine that has finished goes to those still running. All engines are
+// cancelled once the target energy is reached or when the best energy has
+// not improved for 'patience' seconds.
+//
+namespace spinsolver {
+
+    class portfolio
+    {
+    public:
+        typedef std::vector<result>                 result_list;
+        typedef std::function<result_list()>        spawn_function;
+
+        // target : energy to stop at (-inf for none), patience : seconds
+        // without a better energy before stopping (0 = never)
+        portfolio(double target, double patience, double interval)
+            : _target(target), _patience(patience), _interval(interval)
+            , _min_share(0.1), _step(0.1) {}
+
+        // an engine, spawn blocks until its repetitions are done or it is aborted
+        void add(const std::string &name, std::shared_ptr<solver_master> master, spawn_function spawn)
+        {
+            engine e;
+            e.name   = name;
+            e.master = master;
+            e.spawn  = spawn;
+            _engines.push_back(std::move(e));
+        }
+
+        // the results of all engines, in the order they were added
+        result_list run()
+        {
+            typedef std::chrono::steady_clock clock;
+            clock::time_point start = clock::now();
+            for (auto &e : _engines) {
+                e.master->setShare(1.0/_engines.size());
+                e.running = true;
+                e.done = hpx::async(e.spawn);
+            }
+            double best = std::numeric_limits<double>::infinity();
+            clock::time_point improved = start;
+            std::string reason;
+            while (hpx::is_running()) {
+                std::size_t running = 0;
+                for (auto &e : _engines) {
+                    if (e.running && e.done.is_ready()) {
+                        e.running = false;
+                        std::cout << "Portfolio : " << e.name << " finished" << std::endl;
+                    }
+                    if (e.running) running++;
+                    double E = e.master->bestEnergy();
+                    if (E<e.best) {
+                        e.best = E;
+                        e.seconds = std::chrono::duration<double>(clock::now() - start).count();
+                    }
+                    if (E<best) {
+                        best = E;
+                        improved = clock::now();
+                    }
+                }
+                if (running==0) break;
+                if (best<=_target) {
+                    reason = "target reached";
+                }
+                else if (_patience>0 &&
+                         std::chrono::duration<double>(clock::now() - improved).count()>_patience) {
+                    reason = "no improvement";
+                }
+                if (!reason.empty()) {
+                    std::cout << "Portfolio : " << reason << ", cancelling engines" << std::endl;
+                    for (auto &e : _engines) {
+                        if (e.running) e.master->abort();
+                    }
+                    break;
+                }
+                rebalance();
+                hpx::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(1000*_interval)));
+            }
+            //
+            result_list results;
+            for (auto &e : _engines) {
+                result_list r = e.done.get();
+                e.repetitions = r.size();
+                results.insert(results.end(), r.begin(), r.end());
+            }
+            for (auto &e : _engines) {
+                std::cout << (boost::format("CSVPortfolio , %s, best, %g, at, %.1f, share, %.2f, repetitions, %d\n")
+                    % e.name % e.best % e.seconds % e.master->share() % e.repetitions);
+            }
+            return results;
+        }
+
+    private:
+        struct engine {
+            std::string                     name;
+            std::shared_ptr<solver_master>  master;
+            spawn_function                  spawn;
+            hpx::future<result_list>        done;
+            bool                            running = false;
+            double                          best = std::numeric_limits<double>::infinity();
+            double                          seconds = 0;    // when best was reached
+            std::size_t                     repetitions = 0;
+        };
+
+        // move share from the other running engines to the leader
+        void rebalance()
+        {
+            std::vector<engine*> running;
+            for (auto &e : _engines) {
+                if (e.running) running.push_back(&e);
+            }
+            engine *leader = nullptr;
+            for (auto e : running) {
+                if (e->best==std::numeric_limits<double>::infinity()) continue;
+                if (!leader || e->best<leader->best ||
+                    (e->best==leader->best && e->seconds<leader->seconds)) leader = e;
+            }
+            // the shares of the running engines add up to 1
+            double total = 0;
+            for (auto e : running) total += e->master->share();
+            std::vector<double> share;
+            for (auto e : running) share.push_back(e->master->share()/total);
+            if (leader && running.size()>1) {
+                for (std::size_t i=0; i<running.size(); ++i) {
+                    if (running[i]==leader) continue;
+                    double d = (std::min)(_step, (std::max)(share[i] - _min_share, 0.0));
+                    share[i] -= d;
+                    share[std::find(running.begin(), running.end(), leader) - running.begin()] += d;
+                }
+            }
+            bool changed = false;
+            for (std::size_t i=0; i<running.size(); ++i) {
+                if (std::abs(share[i] - running[i]->master->share())>1e-6) changed = true;
+                running[i]->master->setShare(share[i]);
+            }
+            if (changed) {
+                std::cout << "Portfolio :";
+                for (auto e : running) {
+                    std::cout << (boost::format(" %s %.2f (best %g)") % e->name % e->master->share() % e->best);
+                }
+                std::cout << std::endl;
+            }
+        }
+
+        double                  _target;
+        double                  _patience;
+        double                  _interval;
+        double                  _min_share;
+        double                  _step;
+        std::vector<engine>     _engines;
+    };
+}
+
+#endif
@@ -0,0 +1,446 @@
+#ifndef __PROVISIONER_H__
+#define __PROVISIONER_H__
+
+#include <hpx/hpx.hpp>
+#include <hpx/util/asio_util.hpp>
+//
+#include <boost/lexical_cast.hpp>
+//
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+//
+#include "CommandCapture.h"
+
+//
+// Node provisioning of rank 0. Requests for nodes are queued and the batch
+// system commands (job script generator, sbatch, squeue, scancel) run on a
+// dedicated I/O thread outside the HPX scheduler, so no worker thread waits
+// for slurm. Each request is an allocation that goes through
+//    requested -> pending (queued by the batch system) -> running
+//              -> connected (all of its localities joined) -> released
+// or failed if it cannot be submitted. The localities of an allocation
+// report its id when they connect (see locality_data::allocation), which is
+// how localities and allocations are matched.
+//
+namespace spinsolver { namespace provisioning {
+
+    enum class allocation_state {
+        requested,
+        pending,
+        running,
+        connected,
+        released,
+        failed,
+        unknown     // the batch system could not be asked, try again later
+    };
+
+    inline const char* to_string(allocation_state s)
+    {
+        switch (s) {
+        case allocation_state::requested: return "Requested";
+        case allocation_state::pending:   return "Pending";
+        case allocation_state::running:   return "Running";
+        case allocation_state::connected: return "Connected";
+        case allocation_state::released:  return "Released";
+        case allocation_state::failed:    return "Failed";
+        case allocation_state::unknown:   return "Unknown";
+        }
+        return "Invalid";
+    }
+
+    struct allocation {
+        std::string         backend;
+        std::string         name;           // our name, the job name in slurm
+        std::string         job;            // id given by the batch system
+        int                 nodes     = 0;
+        int                 minutes   = 0;
+        allocation_state    state     = allocation_state::requested;
+        int                 connected = 0;  // localities of it that joined
+    };
+
+    //
+    // A batch system that nodes can be requested from. The calls block and
+    // are only made on the I/O thread.
+    //
+    class backend
+    {
+    public:
+        virtual ~backend() {}
+        // returns the job id, throws if the request was not accepted
+        virtual std::string submit(const allocation &a) = 0;
+        // pending, running, or released once the job has ended; unknown if
+        // the batch system did not answer
+        virtual allocation_state query(const std::string &job) = 0;
+        virtual void cancel(const std::string &job) = 0;
+    };
+
+    //
+    // Slurm : a job script is written by scripts/add_nodes-*.sh and submitted
+    // with sbatch, its localities connect to the AGAS server of rank 0
+    //
+    class slurm_backend : public backend
+    {
+    public:
+        slurm_backend(const std::string &script, int agas_port, const std::string &partition,
+                      const std::string &account, const std::string &reservation)
+            : _script(script), _agas_port(agas_port), _partition(partition)
+            , _account(account), _reservation(reservation) {}
+
+        std::string submit(const allocation &a)
+        {
+            // script params
+            // "Usage : %1:Session name ($1)"
+            // "        %2:Hours needed ($2)"
+            // "        %3:Minutes needed ($3)"
+            // "        %4:server-num-nodes ($4)"
+            // "        %5:server-ip:port ($5)"
+            // "        %6:Partition ($6)"
+            // "        %7:Account ($7)"
+            // "        %8:reservation (${8})"
+            std::string my_ip = hpx::util::resolve_public_ip_address();
+            std::vector<std::string> command_list = {
+                _script, a.name, std::to_string(a.minutes/60), std::to_string(a.minutes%60),
+                std::to_string(a.nodes), my_ip + ":" + std::to_string(_agas_port),
+                _partition, _account, _reservation
+            };
+            // sbatch reports "Submitted batch job <id>"
+            const std::string submitted = "Submitted batch job ";
+            for (auto &line : ExecuteAndCapture(command_list, 120.0, true)) {
+                std::size_t pos = line.find(submitted);
+                if (pos!=std::string::npos) {
+                    std::string job = line.substr(pos + submitted.size());
+                    return job.substr(0, job.find_first_not_of("0123456789"));
+                }
+            }
+            throw std::runtime_error("sbatch did not return a job id");
+        }
+
+        // The jobs of this user are listed rather than the job by id: asking
+        // for a job that has ended and been purged fails just like a squeue
+        // that cannot reach slurm, and only a squeue that succeeded may
+        // report a job as gone.
+        allocation_state query(const std::string &job)
+        {
+            std::vector<std::string> command_list = { "squeue", "-h", "-o", "%i %T" };
+            const char *user = std::getenv("USER");
+            if (user) {
+                command_list.push_back("-u");
+                command_list.push_back(user);
+            }
+            int status;
+            std::vector<std::string> lines = ExecuteAndCapture(command_list, 30.0, status);
+            if (status!=0) return allocation_state::unknown;
+            for (auto &line : lines) {
+                std::istringstream fields(line);
+                std::string id, state;
+                if (!(fields >> id >> state) || id!=job) continue;
+                if (state=="PENDING" || state=="CONFIGURING") return allocation_state::pending;
+                if (state=="RUNNING" || state=="COMPLETING") return allocation_state::running;
+                return allocation_state::released;
+            }
+            return allocation_state::released;
+        }
+
+        void cancel(const std::string &job)
+        {
+            std::vector<std::string> command_list = { "scancel", job };
+            ExecuteAndCapture(command_list, 30.0, true);
+        }
+
+    private:
+        std::string _script;
+        int         _agas_port;
+        std::string _partition;
+        std::string _account;
+        std::string _reservation;
+    };
+
+    //
+    // A fake batch system for testing on one machine : a job starts its
+    // localities at once as processes of this node that connect to the
+    // running application. Cancel only marks the job ended, its localities
+    // leave when they are drained.
+    //
+    class local_backend : public backend
+    {
+    public:
+        local_backend(const std::string &binary, int agas_port, int threads)
+            : _binary(binary), _agas_port(agas_port), _threads(threads), _jobs(0) {}
+
+        std::string submit(const allocation &a)
+        {
+            std::string job = "local-" + std::to_string(++_jobs);
+            for (int i=0; i<a.nodes; ++i) {
+                std::vector<std::string> command_list = {
+                    "env", "SPINSOLVE_ALLOCATION=" + job, _binary,
+                    "-Ihpx.parcel.port=" + std::to_string(_agas_port),
+                    "--hpx:threads=" + std::to_string(_threads),
+                    "--hpx:connect"
+                };
+                ExecuteAndDetach(command_list, true);
+            }
+            return job;
+        }
+
+        allocation_state query(const std::string &job)
+        {
+            return _ended.count(job) ? allocation_state::released : allocation_state::running;
+        }
+
+        void cancel(const std::string &job) { _ended.insert(job); }
+
+    private:
+        std::string             _binary;
+        int                     _agas_port;
+        int                     _threads;
+        int                     _jobs;
+        std::set<std::string>   _ended;
+    };
+
+    //
+    // The allocations of this run and the I/O thread that talks to the
+    // backends. request/release/connected return at once and may be called
+    // from any (HPX or OS) thread.
+    //
+    class provisioner
+    {
+    public:
+        // called on the I/O thread with an allocation that was not submitted
+        typedef std::function<void(const allocation&)> failure_function;
+
+        provisioner() : _stop(false), _running(false), _poll(30.0), _requests(0) {}
+
+        ~provisioner() { stop(); }
+
+        void add_backend(const std::string &name, std::shared_ptr<backend> b, bool is_default=false)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _backends[name] = b;
+            if (is_default || _default.empty()) _default = name;
+        }
+
+        // start the I/O thread, the batch system is asked for the state of
+        // the allocations every poll_seconds
+        void start(double poll_seconds)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_running) return;
+            _poll    = poll_seconds;
+            _running = true;
+            _thread  = std::thread(&provisioner::io_loop, this);
+        }
+
+        // commands still queued are dropped, safe to call twice
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!_running) return;
+                _running = false;
+                _stop = true;
+            }
+            _wake.notify_one();
+            _thread.join();
+        }
+
+        void on_failure(failure_function f)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _on_failure = f;
+        }
+
+        // ask for nodes for a number of minutes, returns the allocation name
+        std::string request(int nodes, int minutes, const std::string &backend_name="")
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::string name = "spinsolve_" + std::to_string(++_requests);
+            allocation &a = _allocations[name];
+            a.backend = backend_name.empty() ? _default : backend_name;
+            a.name    = name;
+            a.nodes   = nodes;
+            a.minutes = minutes;
+            _commands.push_back([this, name]() { submit(name); });
+            _wake.notify_one();
+            return name;
+        }
+
+        // give back an allocation (by job id), unknown ones are cancelled
+        // on the default backend
+        void release(const std::string &job)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _commands.push_back([this, job]() { cancel(job); });
+            _wake.notify_one();
+        }
+
+        // a locality of the job joined
+        void connected(const std::string &job)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            allocation *a = find(job);
+            if (!a || a->state==allocation_state::released) return;
+            a->connected++;
+            set_state(*a, a->connected>=a->nodes ? allocation_state::connected : allocation_state::running);
+        }
+
+        std::vector<allocation> allocations()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::vector<allocation> result;
+            for (auto &a : _allocations) result.push_back(a.second);
+            return result;
+        }
+
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        // call with _mutex held
+        allocation* find(const std::string &job)
+        {
+            for (auto &a : _allocations) {
+                if (!job.empty() && a.second.job==job) return &a.second;
+            }
+            return nullptr;
+        }
+
+        // call with _mutex held
+        void set_state(allocation &a, allocation_state s)
+        {
+            if (a.state==s) return;
+            a.state = s;
+            std::cout << "Allocation " << a.name << (a.job.empty() ? "" : " job " + a.job)
+                      << " " << to_string(s) << std::endl;
+        }
+
+        void io_loop()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            clock::time_point next_poll = clock::now();
+            while (!_stop) {
+                if (!_commands.empty()) {
+                    std::function<void()> command = _commands.front();
+                    _commands.pop_front();
+                    lock.unlock();
+                    command();
+                    lock.lock();
+                }
+                else if (clock::now()>=next_poll) {
+                    lock.unlock();
+                    poll();
+                    lock.lock();
+                    next_poll = clock::now() +
+                        std::chrono::milliseconds(static_cast<int64_t>(1000*_poll));
+                }
+                else {
+                    _wake.wait_until(lock, next_poll);
+                }
+            }
+        }
+
+        // I/O thread
+        void submit(const std::string &name)
+        {
+            allocation a;
+            std::shared_ptr<backend> b;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                a = _allocations[name];
+                b = _backends[a.backend];
+            }
+            std::string job;
+            try {
+                if (!b) throw std::runtime_error("no scheduler backend " + a.backend);
+                job = b->submit(a);
+            }
+            catch (std::exception &e) {
+                std::cout << "Allocation " << name << " not submitted : " << e.what() << std::endl;
+            }
+            failure_function failed;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                allocation &stored = _allocations[name];
+                stored.job = job;
+                set_state(stored, job.empty() ? allocation_state::failed : allocation_state::pending);
+                if (job.empty()) {
+                    failed = _on_failure;
+                    a = stored;
+                }
+            }
+            if (failed) failed(a);
+        }
+
+        // I/O thread
+        void cancel(const std::string &job)
+        {
+            std::shared_ptr<backend> b;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                allocation *a = find(job);
+                b = _backends[a ? a->backend : _default];
+            }
+            if (b) b->cancel(job);
+            std::lock_guard<std::mutex> lock(_mutex);
+            allocation *a = find(job);
+            if (a) set_state(*a, allocation_state::released);
+        }
+
+        // I/O thread : follow the submitted allocations in the batch system
+        void poll()
+        {
+            std::vector<std::pair<std::string, std::shared_ptr<backend>>> jobs;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                for (auto &a : _allocations) {
+                    allocation_state s = a.second.state;
+                    if (s==allocation_state::pending || s==allocation_state::running ||
+                        s==allocation_state::connected) {
+                        jobs.push_back(std::make_pair(a.second.job, _backends[a.second.backend]));
+                    }
+                }
+            }
+            for (auto &j : jobs) {
+                allocation_state s = j.second->query(j.first);
+                if (s==allocation_state::unknown) {
+                    std::cout << "Allocation job " << j.first << " : state unknown, asking again later" << std::endl;
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(_mutex);
+                allocation *a = find(j.first);
+                if (!a) continue;
+                // connected is set by the localities, not by the batch system
+                if (s==allocation_state::released ||
+                    (s==allocation_state::running && a->state==allocation_state::pending)) {
+                    set_state(*a, s);
+                }
+            }
+        }
+
+        std::mutex                                      _mutex;
+        std::condition_variable                         _wake;
+        std::thread                                     _thread;
+        bool                                            _stop;
+        bool                                            _running;
+        double                                          _poll;
+        int                                             _requests;
+        std::string                                     _default;
+        failure_function                                _on_failure;
+        std::map<std::string, std::shared_ptr<backend>> _backends;
+        std::map<std::string, allocation>               _allocations;
+        std::deque<std::function<void()>>               _commands;
+    };
+}}
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef __SOLVER_COUNTERS_H__
+#define __SOLVER_COUNTERS_H__
+
+#include <hpx/hpx.hpp>
+#include <hpx/include/performance_counters.hpp>
+#include <hpx/performance_counters/counter_creators.hpp>
+#include <hpx/lcos/local/spinlock.hpp>
+#include <hpx/util/high_resolution_clock.hpp>
+//
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+//
+#include "solver_stats.hpp"
+
+//
+// Solver statistics of this locality, summed over all the solve steps that
+// ran here, and exposed as HPX performance counters
+//    /spinsolve{locality#N/total}/sweeps
+//    /spinsolve{locality#N/total}/proposals
+//    /spinsolve{locality#N/total}/accepted-flips
+//    /spinsolve{locality#N/total}/time/delta-energy   [ns]
+//    /spinsolve{locality#N/total}/time/rng            [ns]
+//    /spinsolve{locality#N/total}/hardware/cycles
+//    /spinsolve{locality#N/total}/hardware/cache-misses
+//    /spinsolve{locality#N/total}/hardware/branch-misses
+// and the throughput counters used by the monitor and the scheduler
+//    /spinsolve{locality#N/total}/repetitions/completed
+//    /spinsolve{locality#N/total}/flips-per-second   (proposals/s since the last query
+//                                                     of the same counter instance)
+//    /spinsolve{locality#N/total}/best-energy        (in units of 1/best_energy_scale)
+//    /spinsolve{locality#N/total}/queue-depth        (solve steps running or waiting for a
+//                                                     thread on this locality)
+// so they can be read like /threads{locality#N/total}/idle-rate, e.g. with
+// --hpx:print-counter=/spinsolve{locality#*/total}/accepted-flips
+//
+namespace spinsolver { namespace counters {
+
+    // counter values are integers, the best energy is published in fixed point
+    const double best_energy_scale = 1e6;
+
+    struct locality_stats {
+        hpx::lcos::local::spinlock  mutex;
+        solver_stats                total;
+        double                      best_energy = std::numeric_limits<double>::infinity();
+        // solve steps running on this locality
+        std::atomic<boost::int64_t> running{0};
+        // the HPX counter of the threads waiting to run here, resolved by the
+        // first queue-depth query
+        hpx::lcos::local::spinlock  pending_mutex;
+        hpx::id_type                pending;
+    };
+
+    inline locality_stats& local() {
+        static locality_stats stats;
+        return stats;
+    }
+
+    // called by the solver wrapper when a solve step finishes on this locality
+    inline void add(const solver_stats &stats, double energy) {
+        locality_stats &l = local();
+        std::lock_guard<hpx::lcos::local::spinlock> lock(l.mutex);
+        l.total += stats;
+        l.best_energy = std::min(l.best_energy, energy);
+    }
+
+    // called by the solver wrapper when a solve step starts (+1) and ends (-1)
+    // on this locality
+    inline void running_changed(boost::int64_t delta) {
+        local().running += delta;
+    }
+
+    inline solver_stats get() {
+        locality_stats &l = local();
+        std::lock_guard<hpx::lcos::local::spinlock> lock(l.mutex);
+        return l.total;
+    }
+
+    // counter read function for one field of the locality statistics
+    template <std::uint64_t solver_stats::*Field>
+    boost::int64_t get_field(bool reset) {
+        locality_stats &l = local();
+        std::lock_guard<hpx::lcos::local::spinlock> lock(l.mutex);
+        boost::int64_t value = static_cast<boost::int64_t>(l.total.*Field);
+        if (reset) l.total.*Field = 0;
+        return value;
+    }
+
+    inline boost::int64_t get_completed(bool reset) {
+        return get_field<&solver_stats::repetitions>(reset);
+    }
+
+    // Every instance of the flips-per-second counter (one per reader that
+    // created it) measures the rate since its own previous query, so readers
+    // do not reset each other.
+    inline hpx::naming::gid_type create_flips_per_second(
+        hpx::performance_counters::counter_info const &info, hpx::error_code &ec)
+    {
+        struct baseline {
+            hpx::lcos::local::spinlock  mutex;
+            std::uint64_t               proposals;
+            std::uint64_t               time;
+        };
+        std::shared_ptr<baseline> b = std::make_shared<baseline>();
+        b->proposals = get().proposals;
+        b->time      = hpx::util::high_resolution_clock::now();
+        return hpx::performance_counters::detail::create_raw_counter(info,
+            [b](bool) -> boost::int64_t {
+                std::uint64_t proposals = get().proposals;
+                std::lock_guard<hpx::lcos::local::spinlock> lock(b->mutex);
+                std::uint64_t now = hpx::util::high_resolution_clock::now();
+                double seconds = (now - b->time)*1e-9;
+                boost::int64_t rate = seconds>0 ?
+                    static_cast<boost::int64_t>((proposals - b->proposals)/seconds) : 0;
+                b->time      = now;
+                b->proposals = proposals;
+                return rate;
+            }, ec);
+    }
+
+    inline boost::int64_t get_best_energy(bool reset) {
+        locality_stats &l = local();
+        std::lock_guard<hpx::lcos::local::spinlock> lock(l.mutex);
+        boost::int64_t value = std::isfinite(l.best_energy) ?
+            static_cast<boost::int64_t>(std::llround(l.best_energy*best_energy_scale)) : 0;
+        if (reset) l.best_energy = std::numeric_limits<double>::infinity();
+        return value;
+    }
+
+    // the solve steps running here and the HPX threads queued here, which
+    // are the steps that arrived and wait for a core
+    inline boost::int64_t get_queue_depth(bool) {
+        using hpx::performance_counters::stubs::performance_counter;
+        locality_stats &l = local();
+        hpx::id_type pending;
+        {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(l.pending_mutex);
+            pending = l.pending;
+        }
+        if (!pending) {
+            pending = hpx::performance_counters::get_counter(
+                "/threads{locality#" + std::to_string(hpx::get_locality_id()) +
+                "/total}/count/instantaneous/pending");
+            std::lock_guard<hpx::lcos::local::spinlock> lock(l.pending_mutex);
+            l.pending = pending;
+        }
+        boost::int64_t waiting = performance_counter::get_value_async(pending, false).get().value_;
+        return l.running.load() + waiting;
+    }
+
+    // must run on every locality before the counters are queried,
+    // main() registers it as an HPX startup function
+    inline void register_counter_types() {
+        using hpx::performance_counters::install_counter_type;
+        install_counter_type("/spinsolve/sweeps",
+            &get_field<&solver_stats::sweeps>,
+            "returns the number of Monte Carlo sweeps done on this locality");
+        install_counter_type("/spinsolve/proposals",
+            &get_field<&solver_stats::proposals>,
+            "returns the number of spin flips proposed on this locality");
+        install_counter_type("/spinsolve/accepted-flips",
+            &get_field<&solver_stats::accepted>,
+            "returns the number of spin flips accepted on this locality");
+        install_counter_type("/spinsolve/time/delta-energy",
+            &get_field<&solver_stats::delta_ns>,
+            "returns the time spent computing energy changes (phase instrumentation only)", "ns");
+        install_counter_type("/spinsolve/time/rng",
+            &get_field<&solver_stats::rng_ns>,
+            "returns the time spent in the Metropolis test (phase instrumentation only)", "ns");
+        install_counter_type("/spinsolve/hardware/cycles",
+            &get_field<&solver_stats::cycles>,
+            "returns the CPU cycles spent in solve steps (perf events only)");
+        install_counter_type("/spinsolve/hardware/cache-misses",
+            &get_field<&solver_stats::cache_misses>,
+            "returns the cache misses of solve steps (perf events only)");
+        install_counter_type("/spinsolve/hardware/branch-misses",
+            &get_field<&solver_stats::branch_misses>,
+            "returns the branch misses of solve steps (perf events only)");
+        install_counter_type("/spinsolve/repetitions/completed",
+            &get_completed,
+            "returns the number of solve steps completed on this locality");
+        install_counter_type("/spinsolve/flips-per-second",
+            hpx::performance_counters::counter_raw,
+            "returns the spin flip proposals per second on this locality since the last query",
+            &create_flips_per_second,
+            &hpx::performance_counters::locality_counter_discoverer,
+            HPX_PERFORMANCE_COUNTER_V1, "1/s");
+        install_counter_type("/spinsolve/best-energy",
+            &get_best_energy,
+            "returns the lowest energy found on this locality times best_energy_scale", "1e-6");
+        install_counter_type("/spinsolve/queue-depth",
+            &get_queue_depth,
+            "returns the number of solve steps running or waiting for a thread on this locality");
+    }
+
+}}
+
+#endif
@@ -7,8 +7,29 @@
 #include <boost/pointer_cast.hpp>
 //
 #include "sa_solver.hpp"
+#include "tabu_solver.hpp"
 #include "solver_wrapper.hpp"
 
+//
+// The solvers a locality creates and their options, sent to every locality
+// when it is initialized
+//
+struct solver_config
+{
+  anneal_options  sa;
+  tabu_options    tabu;
+  // create a tabu wrapper besides the SA one (for a portfolio)
+  bool            with_tabu = false;
+  // states the runs of the default instance start from, empty for random spins
+  warm_start      warm;
+
+  template <typename Archive>
+  void serialize(Archive & ar, unsigned)
+  {
+      ar & sa & tabu & with_tabu & warm;
+  }
+};
+
 //
 // The purpose of this class will be to manage the solvers
 // and coordinate the load-balancing and spawning of each.
@@ -29,6 +50,11 @@ public:
   typedef std::shared_ptr<wrapped_solver_class<sa_solver>> solver_ptr;
   solver_ptr _solver_instance;
 
+  // the tabu wrapper, only created when the config asks for it
+  typedef std::shared_ptr<wrapped_solver_class<tabu_solver>> tabu_solver_ptr;
+  hpx::naming::id_type       _agas_tabu_id;
+  tabu_solver_ptr            _tabu_instance;
+
   // for scheduling, we store info about threads/ranks
   void get_hpx_info() {
     _rank        = hpx::naming::get_locality_id_from_id(hpx::find_here());
@@ -42,15 +68,15 @@ public:
   solver_manager() {
   }
 
-  // Initialize the solver for the given Hamiltonian
+  // Initialize the solvers for the given Hamiltonian and config,
   // setup useful HPX vars
-  void initialize(const hamiltonian_type &H) {
+  void initialize(const hamiltonian_type &H, const solver_config &config) {
     get_hpx_info();
     //
     // Create an instance of a wrapped solver on this local node
     //
     try {
-      _agas_Wrapper_id = hpx::components::new_<wrapped_solver_class<sa_solver>>(hpx::find_here(), H).get();
+      _agas_Wrapper_id = hpx::components::new_<wrapped_solver_class<sa_solver>>(hpx::find_here(), H, config.sa).get();
     }
     catch (std::exception &e) {
       std::cout << "Exception creating solver_wrapper " << std::endl;
@@ -66,17 +92,39 @@ public:
     _solver_instance = std::dynamic_pointer_cast<wrapped_solver_class<sa_solver>>(
         hpx::get_ptr_sync<wrapped_solver_class<sa_solver>>(_agas_Wrapper_id)
     );
+    _solver_instance->setWarmStart(config.warm);
+
+    if (config.with_tabu) {
+      try {
+        _agas_tabu_id = hpx::components::new_<wrapped_solver_class<tabu_solver>>(hpx::find_here(), H, config.tabu).get();
+      }
+      catch (std::exception &e) {
+        std::cout << "Exception creating tabu solver_wrapper " << std::endl;
+        std::cout << e.what() << std::endl;
+      }
+      hpx::agas::register_name_sync("/tabu_solver_wrapper/" + boost::lexical_cast<std::string>(_rank), _agas_tabu_id);
+      _tabu_instance = std::dynamic_pointer_cast<wrapped_solver_class<tabu_solver>>(
+          hpx::get_ptr_sync<wrapped_solver_class<tabu_solver>>(_agas_tabu_id)
+      );
+      _tabu_instance->setWarmStart(config.warm);
+    }
   }
 
   solver_ptr getSolver() {
     return _solver_instance;
   }
 
+  // null unless the tabu engine was configured
+  tabu_solver_ptr getTabuSolver() {
+    return _tabu_instance;
+  }
+
   hpx::naming::id_type getId() {
     return _agas_Wrapper_id;
   }
 
   int abort() {
+      if (_tabu_instance) _tabu_instance->abort();
       return _solver_instance->abort();
   }
 };
@@ -5,19 +5,38 @@
 //
 #include <hpx/lcos/local/mutex.hpp>
 #include <hpx/lcos/local/shared_mutex.hpp>
+#include <hpx/lcos/local/spinlock.hpp>
 //
 #include <vector>
+#include <chrono>
 #include <utility>
 #include <tuple>
-#include <queue>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <string>
+#include <atomic>
 #include <cmath>
+#include <limits>
 #include <map>
+#include <set>
 #include <mutex>
 #include <shared_mutex>
 
 #define RDMAHELPER_DISABLE_LOGGING 1
 #include "RdmaLogging.h"
 //
+#include "solver_stats.hpp"
+#include "solver_counters.hpp"
+#include "checkpoint.hpp"
+#include "hamiltonian.hpp"
+#include "instance_cache.hpp"
+#include "numa_placement.hpp"
+#include "lockfree_queues.hpp"
+#include "sa_solver.hpp"
+#include "tabu_solver.hpp"
+#include "warm_start.hpp"
+//
 // This class represents a single solver type that has been wrapped 
 // via the template parameter into an HPX callable layer 
 // so that it can be invoked by remote localities.
@@ -26,13 +45,56 @@
 //
 // Note that for each solver 'type' (class) we must create a new wrapper.
 //
+// Besides the solver it was constructed with (instance 0), a wrapper holds a
+// registry of solvers for further Hamiltonians keyed by their content hash.
+// Solve steps name the instance they are for, so masters spawning different
+// instances share the same wrappers and worker threads.
+//
+// On a locality with several NUMA domains each instance has one replica per
+// domain, built by a thread of that domain so that its Hamiltonian and
+// coupling tables are first touched (allocated) there. A solve step runs
+// where the scheduler placed it, on the replica of that thread's domain; the
+// per-step solver state is allocated by that thread as well.
+//
+//
+// Progress of the running spawn of a master, for scaling decisions
+//
+struct spawn_progress {
+    uint64_t    remaining   = 0;    // repetitions not yet collected
+    uint64_t    unissued    = 0;    // of which not yet issued to a locality
+    double      rate        = 0;    // measured repetitions/s of the working localities
+    std::size_t localities  = 0;    // working localities with a measured rate
+};
+
+//
+// The scheduling side of a wrapper acting as a master, whatever solver it
+// wraps, so that rank 0 can drain or fail a locality on the masters of all
+// the engines and a portfolio can share the localities between them
+//
+class solver_master
+{
+public:
+    virtual ~solver_master() {}
+    virtual int64_t drainSolverId(const hpx::id_type &id) = 0;
+    virtual int64_t inFlight(const hpx::id_type &id) const = 0;
+    virtual double stepSeconds(const hpx::id_type &id) const = 0;
+    virtual void abandonSolverId(const hpx::id_type &id) = 0;
+    virtual void removeSolverId(const hpx::id_type &id) = 0;
+    virtual spawn_progress progress() const = 0;
+    // fraction of the cores of every locality the master keeps busy
+    virtual void setShare(double share) = 0;
+    virtual double share() const = 0;
+    // lowest energy collected so far, +inf before the first result
+    virtual double bestEnergy() const = 0;
+    virtual int abort() = 0;
+};
+
 template <class T>
 struct wrapped_solver_class : hpx::components::simple_component_base<wrapped_solver_class<T>>
+                            , solver_master
 {
-    // each solve step will return a future, create a queue for them
-    // note: the futures are HPX_MOVABLE_BUT_NOT_COPYABLE
+    // each solve step returns a future, its continuation queues the result
     typedef hpx::future<typename T::result_type> future_type;
-    typedef std::queue<future_type> task_queue;
     //
     // the output of this solver wrapper is a vector of solutions
     typedef std::vector<typename T::result_type> result_type;
@@ -41,23 +103,133 @@ struct wrapped_solver_class : hpx::components::simple_component_base<wrapped_sol
 
     // this is the internal solver we are wrapping
     T                                   _theSolver;
+    // replicas (one per NUMA domain) of _theSolver as instance 0 and of
+    // further instances, and the instance spawn() issues solve steps for
+    typedef std::vector<std::shared_ptr<T>> replica_list;
+    solver_mutex_type                   _instance_mutex;
+    std::map<uint64_t, replica_list>    _instances;
+    uint64_t                            _instance;
+    // warm starts of the jobs running on an instance, keyed by (instance,
+    // job key), and the job key of the steps spawn() issues (0 for none)
+    typedef std::pair<uint64_t, uint64_t> warm_start_key;
+    std::map<warm_start_key, std::shared_ptr<const warm_start>> _warm_starts;
+    uint64_t                            _warm_key;
     double                              _complexity;
     uint64_t                            _rank;
-    uint64_t                            _nranks;
     std::size_t                         _os_threads;
-    bool                                _abort;
-    solver_mutex_type                   _solver_id_mutex;
-    std::vector<hpx::id_type>           _solver_ids;
-    std::map<hpx::id_type, int>         _solver_counter;
-    std::atomic<bool>                   _new_solver;
-    std::map<hpx::id_type, task_queue>  _async_results;
+    std::atomic<bool>                   _abort;
+    // share of the cores of each locality (1 unless a portfolio races
+    // several masters on the same localities), and the best energy collected
+    std::atomic<double>                 _share;
+    std::atomic<double>                 _best_energy;
+    //
+    // Scheduler state, shared by the spawn loop, the collector thread and the
+    // continuations of the solve steps without locks. Each solver id has a
+    // slot: the spawn loop passes the seeds it issues to the collector through
+    // a SPSC ring, the continuations (which run on any thread) pass finished
+    // steps to the collector through a MPSC queue, so a slow step never holds
+    // up the results queued behind it.
+    struct completion {
+        uint64_t                        seed = 0;
+        bool                            ok = false;
+        typename T::result_type         result;
+        std::string                     error;
+        std::chrono::steady_clock::time_point time;
+    };
+    struct issued_step {
+        uint64_t                        seed = 0;
+        std::chrono::steady_clock::time_point time;
+    };
+    struct locality_slot {
+        hpx::id_type                    id;
+        spinsolver::lockfree::spsc_ring<issued_step> issued;
+        spinsolver::lockfree::mpsc_queue<completion> completed;
+        // steps issued and not yet collected, steps collected, and the
+        // measured solve steps per second (smoothed, 0 until measured)
+        std::atomic<int64_t>            in_flight;
+        std::atomic<uint64_t>           repetitions;
+        std::atomic<double>             rate;
+        // seconds from issuing a step to its result (smoothed, 0 until
+        // measured), includes the time queued behind other steps
+        std::atomic<double>             step_seconds;
+        // a draining slot gets no new steps, a removed one leaves the list
+        // once it has none in flight, an abandoned one has its steps in
+        // flight issued again elsewhere and their results dropped
+        std::atomic<bool>               draining;
+        std::atomic<bool>               removed;
+        std::atomic<bool>               abandoned;
+        // collector only: seeds in flight with their issue time, statistics
+        // of the results and whether the seeds of an abandoned slot have
+        // been handed back
+        std::map<uint64_t, std::chrono::steady_clock::time_point> outstanding;
+        solver_stats                    stats;
+        bool                            released;
+        // spawn loop only: repetitions at the last rate update
+        uint64_t                        last_repetitions;
+
+        locality_slot(const hpx::id_type &s, std::size_t capacity)
+            : id(s), issued(capacity), in_flight(0), repetitions(0), rate(0), step_seconds(0)
+            , draining(false), removed(false), abandoned(false), released(false), last_repetitions(0) {}
+    };
+    typedef spinsolver::lockfree::cow_list<std::shared_ptr<locality_slot>> slot_membership;
+    typedef slot_membership::list_type slot_list;
+    // Membership: setSolverIds/addSolverId/removeSolverId publish a new slot
+    // list, readers keep their snapshot until they see a new epoch, only
+    // writers take the mutex.
+    hpx::lcos::local::spinlock          _membership_mutex;
+    slot_membership                     _slots;
+    std::atomic<uint64_t>               _nranks;
+    // set while spawn collects results, and by the collector when a removed
+    // slot can be dropped from the list
+    std::atomic<bool>                   _collecting;
+    std::atomic<bool>                   _prune;
+    // results in completion order, written by the collector only
     result_type                         _repetition_results_vector;
-    int                                 _total_completed;
+    std::atomic<uint64_t>               _total_completed;
+    // repetitions of the running spawn and those not yet issued
+    std::atomic<uint64_t>               _num_reps;
+    std::atomic<uint64_t>               _unissued;
+    // seeds of failed steps to issue again, collector -> spawn loop, and
+    // those that did not fit into the ring (collector only)
+    spinsolver::lockfree::spsc_ring<uint64_t> _reissue;
+    std::deque<uint64_t>                _reissue_backlog;
+    // seconds of work to keep queued on a locality once its rate is known
+    double                              _queue_seconds;
+    // checkpointing, results [0,_checkpointed) are in the file, later ones are
+    // appended every _checkpoint_interval seconds by a background write
+    std::shared_ptr<checkpoint_writer>  _checkpoint;
+    double                              _checkpoint_interval;
+    std::size_t                         _checkpointed;
+    hpx::future<void>                   _checkpoint_write;
+    std::chrono::steady_clock::time_point _checkpoint_time;
+    // seeds completed by an earlier run, not issued again
+    std::set<uint64_t>                  _completed_seeds;
+    // the next seed the spawn loop will issue and the time spent so far
+    std::atomic<uint64_t>               _next_seed;
+    double                              _elapsed_offset;
+    std::chrono::steady_clock::time_point _spawn_time;
 
     // provide a constructor, passing Args through to the internal class
     template <typename ...Args>
-    wrapped_solver_class(Args&&... args) : _theSolver(std::forward<Args>(args)...) {
+    wrapped_solver_class(Args&&... args)
+        : _theSolver(std::forward<Args>(args)...), _reissue(1024)
+    {
         _abort = false;
+        _share = 1.0;
+        _best_energy = std::numeric_limits<double>::infinity();
+        _nranks = 0;
+        _collecting = false;
+        _prune = false;
+        _total_completed = 0;
+        _num_reps = 0;
+        _unissued = 0;
+        _instance = 0;
+        _warm_key = 0;
+        _queue_seconds = 2.0;
+        _checkpoint_interval = 60.0;
+        _checkpointed = 0;
+        _next_seed = 0;
+        _elapsed_offset = 0;
         get_hpx_info();
     };
 
@@ -84,64 +256,414 @@ struct wrapped_solver_class : hpx::components::simple_component_base<wrapped_sol
         type get(Args... args) { return std::get<i>(std::tuple<Args...>(args...)); }
     };
 
+    // the largest number of steps queue_limit allows in flight on a locality
+    std::size_t max_queue() const { return _os_threads*50; }
+
+    // the current slot list
+    std::shared_ptr<const slot_list> slots() const {
+        return _slots.snapshot();
+    }
+
+    // call with _membership_mutex held, removed slots are dropped from the
+    // list once the collector has nothing left of them
+    void publish(std::shared_ptr<slot_list> slots) {
+        slots->erase(std::remove_if(slots->begin(), slots->end(),
+            [](const std::shared_ptr<locality_slot> &s) { return s->removed && s->in_flight==0; }),
+            slots->end());
+        _nranks = std::count_if(slots->begin(), slots->end(),
+            [](const std::shared_ptr<locality_slot> &s) { return !s->draining; });
+        _slots.publish(slots);
+    }
+
+    std::shared_ptr<locality_slot> find_slot(const hpx::id_type &id) const {
+        std::shared_ptr<const slot_list> list = slots();
+        auto it = std::find_if(list->begin(), list->end(),
+            [&id](const std::shared_ptr<locality_slot> &s) { return s->id==id; });
+        return it!=list->end() ? *it : std::shared_ptr<locality_slot>();
+    }
+
     // deprecated
     void setSolverIds(const std::vector<hpx::id_type> &ids) {
-        // unique lock for exclusive write access
-        LOG_DEBUG_MSG("taking solver_id_mutex in setSolverIds");
-        std::unique_lock<solver_mutex_type> lock(_solver_id_mutex);
-        _solver_ids = ids;
-        _nranks = _solver_ids.size();
-        _new_solver.store(true);
-        for (auto s : _solver_ids) {
-            _solver_counter[s] = 0;
+        LOG_DEBUG_MSG("taking membership_mutex in setSolverIds");
+        std::lock_guard<hpx::lcos::local::spinlock> lock(_membership_mutex);
+        // ids that are already known keep their slot and the steps in flight
+        std::shared_ptr<const slot_list> old = slots();
+        std::shared_ptr<slot_list> list = std::make_shared<slot_list>();
+        for (auto &id : ids) {
+            auto it = std::find_if(old->begin(), old->end(),
+                [&id](const std::shared_ptr<locality_slot> &s) { return s->id==id; });
+            list->push_back(it!=old->end() ? *it : std::make_shared<locality_slot>(id, max_queue()));
         }
-        std::cout << "After setSolverIds : size is " << _solver_ids.size() << std::endl;
-        LOG_DEBUG_MSG("releasing solver_id_mutex in setSolverIds");
+        publish(list);
+        std::cout << "After setSolverIds : size is " << _nranks << std::endl;
+        LOG_DEBUG_MSG("releasing membership_mutex in setSolverIds");
     }
 
     void addSolverId(const hpx::id_type &id) {
-        // unique lock for exclusive write access
-        LOG_DEBUG_MSG("taking solver_id_mutex in addSolverId");
-        std::unique_lock<solver_mutex_type> lock(_solver_id_mutex);
-        _solver_ids.push_back(id);
-        _nranks = _solver_ids.size();
-        _new_solver.store(true);
-        _solver_counter[id] = 0;
-        std::cout << "After addSolverId : size is " << _solver_ids.size() << std::endl;
-        LOG_DEBUG_MSG("releasing solver_id_mutex in addSolverId");
-    }
-
-    // if any of the threads have completed, pull them off the queue
-    // @todo, if one thread takes much longer, finished jobs will be stuck in the queue
-    // so we must only use threads which are from the same solver params for now
-    // shared lock for read access
-    static void remove_completed_solver_steps(wrapped_solver_class<T> *self)
+        LOG_DEBUG_MSG("taking membership_mutex in addSolverId");
+        std::lock_guard<hpx::lcos::local::spinlock> lock(_membership_mutex);
+        std::shared_ptr<slot_list> list = std::make_shared<slot_list>(*slots());
+        list->push_back(std::make_shared<locality_slot>(id, max_queue()));
+        publish(list);
+        std::cout << "After addSolverId : size is " << _nranks << std::endl;
+        LOG_DEBUG_MSG("releasing membership_mutex in addSolverId");
+    }
+
+    // Scale down: stop issuing steps to a solver id, its steps in flight are
+    // still collected. Returns the number of steps in flight, -1 if unknown.
+    int64_t drainSolverId(const hpx::id_type &id) override {
+        std::lock_guard<hpx::lcos::local::spinlock> lock(_membership_mutex);
+        std::shared_ptr<locality_slot> slot = find_slot(id);
+        if (!slot) return -1;
+        slot->draining = true;
+        publish(std::make_shared<slot_list>(*slots()));
+        std::cout << "After drainSolverId : size is " << _nranks << std::endl;
+        return slot->in_flight;
+    }
+
+    // steps issued to a solver id and not yet collected
+    int64_t inFlight(const hpx::id_type &id) const override {
+        std::shared_ptr<locality_slot> slot = find_slot(id);
+        return slot ? int64_t(slot->in_flight) : 0;
+    }
+
+    // measured seconds from issuing a step to a solver id until its result
+    // arrives, 0 if not known yet
+    double stepSeconds(const hpx::id_type &id) const override {
+        std::shared_ptr<locality_slot> slot = find_slot(id);
+        return slot ? double(slot->step_seconds) : 0;
+    }
+
+    // give up the steps in flight on a (draining) solver id: the collector
+    // issues their seeds again elsewhere and drops results that still arrive
+    void abandonSolverId(const hpx::id_type &id) override {
+        std::shared_ptr<locality_slot> slot = find_slot(id);
+        if (!slot) return;
+        slot->draining = true;
+        slot->abandoned = true;
+        if (!_collecting) {
+            // nothing is running that could hand the seeds back
+            slot->in_flight = 0;
+        }
+    }
+
+    // drain a solver id and drop it from the list when nothing of it is left
+    void removeSolverId(const hpx::id_type &id) override {
+        std::lock_guard<hpx::lcos::local::spinlock> lock(_membership_mutex);
+        std::shared_ptr<locality_slot> slot = find_slot(id);
+        if (!slot) return;
+        slot->draining = true;
+        slot->removed = true;
+        publish(std::make_shared<slot_list>(*slots()));
+        std::cout << "After removeSolverId : size is " << _nranks << std::endl;
+    }
+
+    // a copy of the solver for every NUMA domain, each cloned on its domain
+    static replica_list replicate(const T &solver) {
+        spinsolver::numa::domains_type &domains = spinsolver::numa::domains();
+        if (domains.size()==1) {
+            return replica_list(1, std::make_shared<T>(solver));
+        }
+        std::vector<hpx::future<std::shared_ptr<T>>> cloned;
+        for (std::size_t d=0; d<domains.size(); ++d) {
+            cloned.push_back(spinsolver::numa::async_on_domain(d,
+                [&solver]() { return std::make_shared<T>(solver.clone()); }));
+        }
+        return hpx::util::unwrapped(cloned);
+    }
+
+    // register a solver for H under its content hash (once), returns the hash.
+    // The instance stays in this locality's cache while it is registered.
+    uint64_t addInstance(const hamiltonian_type &H) {
+        uint64_t id = H.content_hash();
+        {
+            std::shared_lock<solver_mutex_type> lock(_instance_mutex);
+            if (_instances.find(id)!=_instances.end()) return id;
+        }
+        replica_list replicas = replicate(T(H, _theSolver.options()));
+        bool added;
+        {
+            std::unique_lock<solver_mutex_type> lock(_instance_mutex);
+            added = _instances.insert(std::make_pair(id, replicas)).second;
+        }
+        if (added) spinsolver::instances::pin(id);
+        return id;
+    }
+
+    // the replicas of an instance, those of _theSolver are made on first use
+    replica_list replicas(uint64_t instance) {
+        {
+            std::shared_lock<solver_mutex_type> lock(_instance_mutex);
+            auto it = _instances.find(instance);
+            if (it!=_instances.end()) return it->second;
+        }
+        if (instance!=0) {
+            throw std::runtime_error("solve step for an instance that is not registered");
+        }
+        replica_list replicas = replicate(_theSolver);
+        std::unique_lock<solver_mutex_type> lock(_instance_mutex);
+        return _instances.insert(std::make_pair(instance, replicas)).first->second;
+    }
+
+    // register an instance that was distributed to this locality's instance cache
+    uint64_t addCachedInstance(uint64_t id) {
+        return addInstance(*spinsolver::instances::get(id));
+    }
+
+    // register the instance made by applying a delta to a cached one, so that
+    // only the delta is sent to the locality; returns its hash
+    uint64_t addDeltaInstance(uint64_t base, const hamiltonian_delta &delta) {
+        return addInstance(*spinsolver::instances::get(spinsolver::instances::apply_delta(base, delta)));
+    }
+
+    // drop a registered instance, solve steps already running keep their copy
+    int removeInstance(uint64_t id) {
+        int removed;
+        {
+            std::unique_lock<solver_mutex_type> lock(_instance_mutex);
+            removed = static_cast<int>(_instances.erase(id));
+        }
+        if (removed && id!=0) spinsolver::instances::unpin(id);
+        return removed;
+    }
+
+    // start the runs of _theSolver (instance 0) from the states of a warm
+    // start, call before any step is spawned
+    void setWarmStart(const warm_start &warm) {
+        std::shared_ptr<const warm_start> state = std::make_shared<const warm_start>(warm);
+        std::unique_lock<solver_mutex_type> lock(_instance_mutex);
+        _theSolver.set_warm_start(state);
+        // replicas made before are made again from _theSolver on first use
+        _instances.erase(0);
+    }
+
+    // the warm start of the steps of one job on an instance, so that jobs
+    // running on the same instance at the same time keep their own. Steps of
+    // a job without one start from random spins.
+    void addJobWarmStart(uint64_t instance, uint64_t job, const warm_start &warm) {
+        std::shared_ptr<const warm_start> state = std::make_shared<const warm_start>(warm);
+        std::unique_lock<solver_mutex_type> lock(_instance_mutex);
+        _warm_starts[warm_start_key(instance, job)] = state;
+    }
+
+    int removeJobWarmStart(uint64_t instance, uint64_t job) {
+        std::unique_lock<solver_mutex_type> lock(_instance_mutex);
+        return static_cast<int>(_warm_starts.erase(warm_start_key(instance, job)));
+    }
+
+    // the warm start of a job, null if it has none
+    std::shared_ptr<const warm_start> jobWarmStart(uint64_t instance, uint64_t job) {
+        if (job==0) return std::shared_ptr<const warm_start>();
+        std::shared_lock<solver_mutex_type> lock(_instance_mutex);
+        auto it = _warm_starts.find(warm_start_key(instance, job));
+        return it==_warm_starts.end() ? std::shared_ptr<const warm_start>() : it->second;
+    }
+
+    // the instance that spawn() solves, it must be registered on every solver id
+    void setInstance(uint64_t id) { _instance = id; }
+
+    // the job key spawn() passes with its steps, their warm start is the one
+    // added for (instance, key) on each solver id
+    void setWarmStartKey(uint64_t key) { _warm_key = key; }
+
+    // write completed repetitions to this checkpoint every interval seconds
+    void setCheckpoint(std::shared_ptr<checkpoint_writer> writer, double interval) {
+        _checkpoint = writer;
+        _checkpoint_interval = interval;
+    }
+
+    // results of an earlier run that is being resumed, their seeds are skipped
+    // by spawn and they are returned with the new results. They must already
+    // be in the checkpoint file.
+    void setCompleted(const result_type &completed, double elapsed) {
+        for (auto &r : completed) {
+            _completed_seeds.insert(r.seed_);
+            _repetition_results_vector.push_back(r);
+            if (r.E_ < _best_energy) _best_energy = r.E_;
+        }
+        _checkpointed = _repetition_results_vector.size();
+        _elapsed_offset = elapsed;
+    }
+
+    // Hand the results collected since the last checkpoint to a background
+    // write. Only called from the thread that collects results, so no lock
+    // is needed on the results vector; skipped while the previous write is
+    // still running unless final is set.
+    void checkpoint(bool final) {
+        if (!_checkpoint) return;
+        auto now = std::chrono::steady_clock::now();
+        if (!final) {
+            if (_checkpoint_write.valid() && !_checkpoint_write.is_ready()) return;
+            if (std::chrono::duration<double>(now - _checkpoint_time).count() < _checkpoint_interval) return;
+        }
+        if (_checkpoint_write.valid()) _checkpoint_write.get();
+        _checkpoint_time = now;
+        if (_checkpointed == _repetition_results_vector.size()) return;
+        //
+        result_type chunk(_repetition_results_vector.begin() + _checkpointed, _repetition_results_vector.end());
+        _checkpointed = _repetition_results_vector.size();
+        double elapsed = _elapsed_offset + std::chrono::duration<double>(now - _spawn_time).count();
+        uint64_t next_seed = _next_seed;
+        std::shared_ptr<checkpoint_writer> writer = _checkpoint;
+        _checkpoint_write = hpx::async([=]() { writer->write(chunk, next_seed, elapsed); });
+        if (final) _checkpoint_write.get();
+    }
+
+    // Collect the finished solve steps of every slot until num_reps results
+    // are in. Runs on its own thread during spawn; it is the only consumer of
+    // the slot queues and the only writer of the results vector and checkpoint.
+    static void collect_completed_solver_steps(wrapped_solver_class<T> *self, uint64_t num_reps)
     {
-        while (hpx::is_running() && !self->_abort) {
-            // shared lock solver_ids for read access
-            LOG_DEBUG_MSG("taking solver_id_mutex in remove_completed_solver_steps");
-            std::shared_lock<solver_mutex_type> lock(self->_solver_id_mutex);
-            for (auto s : self->_solver_ids) {
-                std::queue<future_type> &tasks = self->_async_results[s];
-                while (!tasks.empty()) {
-                    future_type &fut = tasks.front();
-                    if (fut.is_ready()) {
-                        // the future completed, so put the result on our return vector
-                        // @todo, we should perform IO as soon as the thread completes
-                        // the solve step.
-                        self->_repetition_results_vector.push_back(std::move(fut.get()));
-                        // and pop the completed future
-                        tasks.pop();
-                        self->_total_completed++;
-                    }
-                    else {
-                        break;
-                    }
+        std::shared_ptr<const slot_list> slots;
+        uint64_t epoch = ~uint64_t(0);
+        while (hpx::is_running() && !self->_abort && self->_total_completed<num_reps) {
+            self->_slots.refresh(slots, epoch);
+            for (auto &slot : *slots) {
+                self->collect(*slot);
+                // check again on the next pass, so that the list is
+                // republished without it
+                if (slot->removed && slot->in_flight==0) self->_prune = true;
+            }
+            if (self->_prune.exchange(false)) {
+                std::lock_guard<hpx::lcos::local::spinlock> lock(self->_membership_mutex);
+                self->publish(std::make_shared<slot_list>(*self->slots()));
+            }
+            // hand the seeds of failed steps back to the spawn loop
+            while (!self->_reissue_backlog.empty() && self->_reissue.push(self->_reissue_backlog.front())) {
+                self->_reissue_backlog.pop_front();
+            }
+            self->checkpoint(false);
+            hpx::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    // collector only
+    void collect(locality_slot &slot) {
+        if (slot.abandoned) {
+            release(slot);
+            return;
+        }
+        issued_step step;
+        // a seed is pushed before its step is issued, so it is always known
+        // here before the step's completion
+        while (slot.issued.pop(step)) {
+            slot.outstanding[step.seed] = step.time;
+        }
+        completion done;
+        while (slot.completed.pop(done)) {
+            auto it = slot.outstanding.find(done.seed);
+            if (it!=slot.outstanding.end()) {
+                double seconds = std::chrono::duration<double>(done.time - it->second).count();
+                double old = slot.step_seconds;
+                slot.step_seconds = old<=0 ? seconds : 0.8*old + 0.2*seconds;
+                slot.outstanding.erase(it);
+            }
+            if (done.ok) {
+                std::uint64_t result_ns = 0;
+                {
+                    phase_timer t(result_ns);
+                    _repetition_results_vector.push_back(std::move(done.result));
                 }
+                if (_repetition_results_vector.back().E_ < _best_energy) {
+                    _best_energy = _repetition_results_vector.back().E_;
+                }
+                solver_stats &stats = _repetition_results_vector.back().stats_;
+                stats.result_ns += result_ns;
+                slot.stats += stats;
+                ++slot.repetitions;
+                ++_total_completed;
+            }
+            else {
+                std::cout << "Solve step with seed " << done.seed << " failed : " << done.error << std::endl;
+                _reissue_backlog.push_back(done.seed);
+            }
+            --slot.in_flight;
+        }
+    }
+
+    // hand the seeds of an abandoned slot back to the spawn loop, including
+    // those the spawn loop issued to it before it saw the slot draining
+    void release(locality_slot &slot) {
+        issued_step step;
+        while (slot.issued.pop(step)) {
+            slot.outstanding[step.seed] = step.time;
+        }
+        completion late;
+        while (slot.completed.pop(late)) {}
+        if (!slot.released && !slot.outstanding.empty()) {
+            std::cout << "Issuing " << slot.outstanding.size() << " steps of locality "
+                << hpx::naming::get_locality_id_from_id(slot.id) << " again" << std::endl;
+        }
+        slot.released = true;
+        for (auto &s : slot.outstanding) {
+            _reissue_backlog.push_back(s.first);
+            --slot.in_flight;
+        }
+        slot.outstanding.clear();
+    }
+
+    // progress of the running spawn, for scaling decisions
+    typedef spawn_progress progress_type;
+
+    progress_type progress() const override {
+        progress_type p;
+        if (!_collecting) return p;
+        uint64_t done = _total_completed;
+        p.remaining = _num_reps>done ? _num_reps - done : 0;
+        p.unissued  = _unissued;
+        double s = share();
+        for (auto &slot : *slots()) {
+            double rate = slot->rate;
+            if (slot->draining || rate<=0) continue;
+            p.rate += s*rate;
+            p.localities++;
+        }
+        return p;
+    }
+
+    void setShare(double share) override {
+        _share = (std::min)((std::max)(share, 0.01), 1.0);
+    }
+
+    double share() const override { return _share; }
+
+    double bestEnergy() const override { return _best_energy; }
+
+    // How many solve steps to keep in flight on a locality. Until its throughput
+    // is measured we use a fixed multiple of the thread count, afterwards enough
+    // for _queue_seconds of work so that fast localities get more and slow ones
+    // do not hoard repetitions at the end of the run. With a share below 1 the
+    // queue is cut in proportion, so that the masters sharing the locality
+    // keep their share of its cores busy.
+    std::size_t queue_limit(const locality_slot &slot) const {
+        double rate = slot.rate;
+        double s = share();
+        if (rate<=0) {
+            return (std::max)(static_cast<std::size_t>(std::ceil(s*_os_threads*5)), std::size_t(1));
+        }
+        std::size_t limit = static_cast<std::size_t>(std::ceil(s*rate*_queue_seconds));
+        std::size_t least = (std::max)(static_cast<std::size_t>(std::ceil(s*_os_threads)), std::size_t(1));
+        return (std::min)((std::max)(limit, least), max_queue());
+    }
+
+    // update the smoothed solve rate of every locality from the number of
+    // results collected from it since the last call (spawn loop only). The
+    // rate is kept for the whole locality, the one measured with a share
+    // below 1 is scaled up.
+    void update_rates(const slot_list &slots, double seconds) {
+        if (seconds<=0) return;
+        double s = share();
+        for (auto &slot : slots) {
+            uint64_t done = slot->repetitions;
+            double rate = (done - slot->last_repetitions)/seconds/s;
+            slot->last_repetitions = done;
+            double old = slot->rate;
+            if (old<=0) {
+                if (done>0) slot->rate = rate;
+            }
+            else {
+                slot->rate = 0.5*old + 0.5*rate;
             }
-            lock.unlock();
-            LOG_DEBUG_MSG("releasing solver_id_mutex in remove_completed_solver_steps");
-            hpx::this_thread::sleep_for(std::chrono::milliseconds(250));
         }
     }
 
@@ -149,14 +671,16 @@ struct wrapped_solver_class : hpx::components::simple_component_base<wrapped_sol
     result_type spawn(uint64_t num_reps, Args&&... args)
     {
         // final results go here
+        // (results restored by setCompleted are already in it)
         _repetition_results_vector.reserve(num_reps);
-        _total_completed = 0;
+        _total_completed = _repetition_results_vector.size();
+        _spawn_time = _checkpoint_time = std::chrono::steady_clock::now();
         //
         // threads should include num Sweeps if complexity is high
         // assume all nodes have same core counts for now
         double num_required_threads = num_reps;
-        double num_hardware_threads = _nranks*_os_threads;
-        int local_seed_offset = _rank*std::ceil(num_required_threads/_nranks);
+        uint64_t nranks = (std::max)(uint64_t(_nranks), uint64_t(1));
+        int local_seed_offset = _rank*std::ceil(num_required_threads/nranks);
 
         //
         // instantiate an action; we can call this on multiple threads asynchronously
@@ -171,76 +695,137 @@ struct wrapped_solver_class : hpx::components::simple_component_base<wrapped_sol
             << " num sweeps is " << arg<2, Args&&...>().get(std::forward<Args>(args)...)
             << " OS threads is " << _os_threads << std::endl;
 
-        // start a thread which will remove completed steps from the work lists
-        hpx::future<void> future_completed = hpx::async(remove_completed_solver_steps, this);
+        // start a thread which will collect the results of completed steps
+        _collecting = true;
+        hpx::future<void> future_completed = hpx::async(collect_completed_solver_steps, this, num_reps);
 
-        uint64_t remaining = num_reps;
-        double last_remaining = num_reps;
+        _num_reps = num_reps;
+        _unissued = num_reps>_total_completed ? num_reps - _total_completed : 0;
+        double last_remaining = _unissued;
         uint64_t seed = 0;
-        const int default_sleep = 100;
-        bool futures_waiting = false;
         //
         // Measure time for solves/s
         std::chrono::time_point<std::chrono::system_clock> t_start = std::chrono::system_clock::now();
-        int reps_this_loop = 0;
+        std::shared_ptr<const slot_list> slots;
+        uint64_t epoch = ~uint64_t(0);
         //
-        while (!_abort && (futures_waiting || remaining>0)) {
-            // as long as there are repetitions left and not too many launched
-            // add new ones to the waiting queue
-            //
-            // @todo, work on some scheduling to find out what a good launch rate is
+        while (!_abort && _total_completed<num_reps) {
+            // localities that joined since the last pass get steps from now on
+            _slots.refresh(slots, epoch);
+            // fill every locality up to its queue limit, seeds of failed
+            // steps first, then new ones
             // @todo, traverse list in sorted order so least occupied nodes get first slot
-
-            // shared lock for read access
             bool enough;
-            if (remaining>0) do {
+            do {
                 enough = true;
-                LOG_DEBUG_MSG("taking sover_id_mutex in spawn loop");
-                std::shared_lock<solver_mutex_type> lock(_solver_id_mutex);
-                for (auto s : _solver_ids) {
-                    if (_async_results[s].size() < (_os_threads*5)) {
-                        future_type fut = hpx::async(solve_step, s, args..., seed + local_seed_offset);
-                        _async_results[s].push( std::move(fut) );
+                for (auto &slot : *slots) {
+                    if (slot->draining || slot->in_flight >= static_cast<int64_t>(queue_limit(*slot))) continue;
+                    // count the step before looking at draining again, so that
+                    // a slot seen drained (0 in flight) gets no more steps
+                    ++slot->in_flight;
+                    if (slot->draining) {
+                        --slot->in_flight;
+                        continue;
+                    }
+                    uint64_t step_seed;
+                    if (!_reissue.pop(step_seed)) {
+                        if (_unissued==0) {
+                            --slot->in_flight;
+                            break;
+                        }
+                        while (_completed_seeds.count(seed + local_seed_offset)) seed++;
+                        step_seed = seed + local_seed_offset;
                         seed ++;
-                        remaining --;
-                        enough = false;
+                        _next_seed = seed + local_seed_offset;
+                        _unissued --;
                     }
-                    if (remaining==0) break;
+                    // cannot be full, a slot never has more than max_queue() seeds in flight
+                    issued_step step;
+                    step.seed = step_seed;
+                    step.time = std::chrono::steady_clock::now();
+                    while (!slot->issued.push(step)) hpx::this_thread::yield();
+                    std::shared_ptr<locality_slot> s = slot;
+                    hpx::async(solve_step, slot->id, _instance, _warm_key, args..., step_seed).then(hpx::launch::sync,
+                        [s, step_seed](future_type f) {
+                            completion done;
+                            done.seed = step_seed;
+                            done.time = std::chrono::steady_clock::now();
+                            try {
+                                done.result = f.get();
+                                done.ok = true;
+                            }
+                            catch (std::exception &e) {
+                                done.error = e.what();
+                            }
+                            s->completed.push(std::move(done));
+                        });
+                    enough = false;
                 }
-                LOG_DEBUG_MSG("releasing sover_id_mutex in spawn loop");
-            } while (!enough && remaining>0);
+            } while (!enough);
             //
             std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
             std::chrono::duration<double> elapsed_seconds = now - t_start;
             t_start = now;
 
-            int _total_remaining = num_reps - _total_completed;
+            uint64_t total_completed = _total_completed;
+            int _total_remaining = num_reps - total_completed;
             double solves_this_iteration = (last_remaining - _total_remaining);
             double solves_per_second = (solves_this_iteration)/elapsed_seconds.count();
             last_remaining = _total_remaining;
+            update_rates(*slots, elapsed_seconds.count());
             //
-            std::cout << (formatter % _total_completed % _total_remaining % solves_this_iteration % elapsed_seconds.count() % solves_per_second);
+            std::cout << (formatter % total_completed % _total_remaining % solves_this_iteration % elapsed_seconds.count() % solves_per_second);
             hpx::this_thread::sleep_for(std::chrono::milliseconds(1000));
         }
 
         std::cout << "Solver Wrapper, waiting for completed thread" << std::endl;
         future_completed.get();
+        _collecting = false;
+        checkpoint(true);
 
         std::cout << "Solver Wrapper, end of spawn loop " << std::endl;
+        for (auto &slot : *this->slots()) {
+            std::cout << "CSVStats , locality, " << hpx::naming::get_locality_id_from_id(slot->id)
+                << ", " << slot->stats << std::endl;
+        }
         // c++11 will move the result to the caller without copying
         return _repetition_results_vector;
     }
 
     template <typename ...Args>
-    typename T::result_type run_one(Args... args) {
+    typename T::result_type run_one(uint64_t instance, uint64_t job, Args... args) {
+        replica_list replica = replicas(instance);
+        // the replica of the domain this thread runs on, no step hops domains
+        std::size_t domain = replica.size()==1 ? 0 : spinsolver::numa::domains().current();
+        return run_replica(*replica[domain % replica.size()], jobWarmStart(instance, job), instance, args...);
+    }
+
+    template <typename ...Args>
+    static typename T::result_type run_replica(const T &solver, std::shared_ptr<const warm_start> warm,
+                                               uint64_t instance, Args... args) {
         // The solver class is not thread safe, so we cannot run N threads on the same instance
-        // create a copy of our internal solver for each new request
-        T newSolver(_theSolver);
+        // create a copy of the replica for each new request, the warm start
+        // of a job is set on the copy only
+        T newSolver(solver);
+        if (warm) newSolver.set_warm_start(warm);
         // std::cout << "Running a single solve " << std::endl;
-        return newSolver.run(args...);
+        spinsolver::counters::running_changed(+1);
+        typename T::result_type res;
+        try {
+            res = newSolver.run(args...);
+        }
+        catch (...) {
+            spinsolver::counters::running_changed(-1);
+            throw;
+        }
+        spinsolver::counters::running_changed(-1);
+        res.instance_ = instance;
+        // sum up the statistics of this locality for the performance counters
+        spinsolver::counters::add(res.stats_, res.E_);
+        return res;
     }
 
-    int abort() {
+    int abort() override {
         _abort = true;
         return 1;
     }
@@ -254,9 +839,34 @@ struct wrapped_solver_class : hpx::components::simple_component_base<wrapped_sol
     //
     template <typename ...Args>
     struct run_one_action : hpx::actions::make_action<
-    typename T::result_type (wrapped_solver_class<T>::*)(Args...),
+    typename T::result_type (wrapped_solver_class<T>::*)(uint64_t, uint64_t, Args...),
     &wrapped_solver_class<T>::template run_one<Args...>, run_one_action<Args...> >
     {};
+
+    struct add_instance_action : hpx::actions::make_action<
+    uint64_t (wrapped_solver_class<T>::*)(uint64_t),
+    &wrapped_solver_class<T>::addCachedInstance, add_instance_action>
+    {};
+
+    struct remove_instance_action : hpx::actions::make_action<
+    int (wrapped_solver_class<T>::*)(uint64_t),
+    &wrapped_solver_class<T>::removeInstance, remove_instance_action>
+    {};
+
+    struct add_delta_instance_action : hpx::actions::make_action<
+    uint64_t (wrapped_solver_class<T>::*)(uint64_t, const hamiltonian_delta&),
+    &wrapped_solver_class<T>::addDeltaInstance, add_delta_instance_action>
+    {};
+
+    struct add_warm_start_action : hpx::actions::make_action<
+    void (wrapped_solver_class<T>::*)(uint64_t, uint64_t, const warm_start&),
+    &wrapped_solver_class<T>::addJobWarmStart, add_warm_start_action>
+    {};
+
+    struct remove_warm_start_action : hpx::actions::make_action<
+    int (wrapped_solver_class<T>::*)(uint64_t, uint64_t),
+    &wrapped_solver_class<T>::removeJobWarmStart, remove_warm_start_action>
+    {};
 };
 
 //
@@ -269,6 +879,12 @@ typedef wrapped_solver_class<sa_solver> solver_type;
 // Define boilerplate required once per component module.
 HPX_REGISTER_COMPONENT(wrapped_solver_type, solver_type);
 
+// the tabu search engine, same interface
+typedef hpx::components::simple_component< wrapped_solver_class<tabu_solver> > wrapped_tabu_solver_type;
+typedef wrapped_solver_class<tabu_solver> tabu_solver_type;
+
+HPX_REGISTER_COMPONENT(wrapped_tabu_solver_type, tabu_solver_type);
+
 // If this code is part of a library, then we need this registration
 // to expose/export the factory creation
 //HPX_REGISTER_COMPONENT_MODULE();
@@ -0,0 +1,292 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <hpx/hpx.hpp>
+#include <hpx/include/performance_counters.hpp>
+#include <hpx/lcos/local/mutex.hpp>
+#include <hpx/lcos/local/spinlock.hpp>
+//
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+//
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+//
+#include "solver_counters.hpp"
+
+//
+// A fixed size ring buffer, keeps the last capacity() elements pushed.
+//
+template <typename T>
+class ring_buffer
+{
+public:
+    explicit ring_buffer(std::size_t capacity=0) : _data(capacity), _next(0), _size(0) {}
+
+    void push(const T &value) {
+        if (_data.empty()) return;
+        _data[_next] = value;
+        _next = (_next + 1) % _data.size();
+        if (_size<_data.size()) ++_size;
+    }
+
+    std::size_t size() const { return _size; }
+    std::size_t capacity() const { return _data.size(); }
+
+    // i=0 is the oldest element still held
+    const T& operator[](std::size_t i) const {
+        return _data[(_next + _data.size() - _size + i) % _data.size()];
+    }
+
+    const T& back() const { return (*this)[_size-1]; }
+
+private:
+    std::vector<T> _data;
+    std::size_t    _next;
+    std::size_t    _size;
+};
+
+//
+// Samples the HPX and solver counters of every ready locality on a fixed
+// cadence. Counter reads are asynchronous and their continuations store the
+// values, so the sampling thread never blocks on a slow or busy locality and
+// spends the time between samples suspended instead of occupying a core.
+// A locality whose previous sample has not returned yet is skipped.
+//
+// The time series of each locality is kept in a ring buffer and appended to
+// a CSV file (one line per locality and sample), or printed to the console
+// in the format of the old monitor if no file is given. The idle-rate is
+// read with reset so that every sample covers the interval since the last.
+//
+class telemetry_service
+{
+public:
+    // one sample of one locality
+    struct sample {
+        double          time;            // [s] since the service started
+        double          idle_rate;       // [%]
+        double          flips_per_second;
+        boost::int64_t  completed;
+        double          best_energy;
+        boost::int64_t  queue_depth;
+    };
+
+    typedef std::function<std::vector<hpx::id_type>()> locality_source;
+
+    telemetry_service() : _running(false), _cadence(1000), _capacity(3600) {}
+
+    ~telemetry_service() { stop(); }
+
+    // localities() is called every cadence to get the localities to sample
+    void start(locality_source localities, boost::uint64_t cadence_ms,
+               std::size_t capacity, const std::string &filename)
+    {
+        if (_running) return;
+        _localities = localities;
+        _cadence    = cadence_ms;
+        _capacity   = capacity;
+        if (!filename.empty()) {
+            _file.open(filename);
+            _file << "time,locality,idle_rate,flips_per_second,completed,best_energy,queue_depth" << std::endl;
+        }
+        _running = true;
+        _loop = hpx::async(&telemetry_service::sample_loop, this);
+    }
+
+    // stop sampling and wait for the sampling thread, safe to call twice
+    void stop()
+    {
+        if (!_running.exchange(false)) return;
+        if (_loop.valid()) _loop.get();
+        std::lock_guard<hpx::lcos::local::mutex> lock(_file_mutex);
+        if (_file.is_open()) _file.close();
+    }
+
+    // copy of the time series of a locality
+    std::vector<sample> series(const hpx::id_type &locality)
+    {
+        std::lock_guard<hpx::lcos::local::spinlock> lock(_mutex);
+        std::vector<sample> result;
+        auto it = _channels.find(locality);
+        if (it!=_channels.end()) {
+            for (std::size_t i=0; i<it->second.samples.size(); ++i) {
+                result.push_back(it->second.samples[i]);
+            }
+        }
+        return result;
+    }
+
+private:
+    static const int num_counters = 5;
+
+    // the counters of one locality and its time series
+    struct channel {
+        std::vector<hpx::id_type>   counters;
+        bool                        resolving = false;
+        std::atomic<bool>           pending{false};
+        ring_buffer<sample>         samples;
+    };
+
+    static std::vector<std::string> counter_names() {
+        return {
+            "/threads{locality#*/total}/idle-rate",
+            "/spinsolve{locality#*/total}/flips-per-second",
+            "/spinsolve{locality#*/total}/repetitions/completed",
+            "/spinsolve{locality#*/total}/best-energy",
+            "/spinsolve{locality#*/total}/queue-depth"
+        };
+    }
+
+    void sample_loop()
+    {
+        hpx::util::high_resolution_timer timer;
+        while (_running && hpx::is_running()) {
+            double now = timer.elapsed();
+            for (auto &l : _localities()) {
+                sample_locality(l, now);
+            }
+            hpx::this_thread::sleep_for(std::chrono::milliseconds(_cadence));
+        }
+        // let outstanding reads finish before the channels can go away
+        while (hpx::is_running() && reads_pending()) {
+            hpx::this_thread::yield();
+        }
+    }
+
+    bool reads_pending()
+    {
+        std::lock_guard<hpx::lcos::local::spinlock> lock(_mutex);
+        for (auto &c : _channels) {
+            if (c.second.pending || c.second.resolving) return true;
+        }
+        return false;
+    }
+
+    void sample_locality(const hpx::id_type &locality, double now)
+    {
+        channel *c;
+        bool resolve;
+        {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(_mutex);
+            auto it = _channels.find(locality);
+            if (it==_channels.end()) {
+                it = _channels.emplace(std::piecewise_construct,
+                    std::forward_as_tuple(locality), std::forward_as_tuple()).first;
+                it->second.samples = ring_buffer<sample>(_capacity);
+            }
+            c = &it->second;
+            if (c->resolving) return;
+            resolve = c->counters.empty();
+            if (resolve) c->resolving = true;
+        }
+        // continuations may run inline, so never issue requests holding the lock
+        if (resolve) {
+            resolve_counters(locality, c);
+            return;
+        }
+        // skip this tick if the last read has not returned
+        if (c->pending.exchange(true)) return;
+
+        using hpx::performance_counters::counter_value;
+        using hpx::performance_counters::stubs::performance_counter;
+        std::vector<hpx::future<counter_value>> values;
+        for (std::size_t i=0; i<c->counters.size(); ++i) {
+            // idle-rate (the first counter) per interval, the others as they are
+            values.push_back(performance_counter::get_value_async(c->counters[i], i==0));
+        }
+        hpx::when_all(values).then(hpx::launch::sync,
+            [this, c, locality, now](hpx::future<std::vector<hpx::future<counter_value>>> f)
+            {
+                std::vector<hpx::future<counter_value>> v = f.get();
+                sample s;
+                s.time = now;
+                std::vector<double> x(num_counters, 0.0);
+                for (std::size_t i=0; i<v.size(); ++i) {
+                    if (v[i].has_exception()) continue;
+                    counter_value value = v[i].get();
+                    if (status_is_valid(value.status_)) x[i] = double(value.value_);
+                }
+                s.idle_rate        = x[0]*0.01;
+                s.flips_per_second = x[1];
+                s.completed        = boost::int64_t(x[2]);
+                s.best_energy      = x[3]/spinsolver::counters::best_energy_scale;
+                s.queue_depth      = boost::int64_t(x[4]);
+                record(locality, *c, s);
+                c->pending = false;
+            });
+    }
+
+    // look up the counter ids of a new locality, sampling starts when they are known
+    void resolve_counters(const hpx::id_type &locality, channel *c)
+    {
+        int rank = hpx::naming::get_locality_id_from_id(locality);
+        std::vector<hpx::future<hpx::id_type>> ids;
+        for (std::string name : counter_names()) {
+            boost::replace_all(name, "#*", "#" + boost::lexical_cast<std::string>(rank));
+            ids.push_back(hpx::performance_counters::get_counter_async(name));
+        }
+        hpx::when_all(ids).then(hpx::launch::sync,
+            [this, c](hpx::future<std::vector<hpx::future<hpx::id_type>>> f)
+            {
+                std::vector<hpx::future<hpx::id_type>> v = f.get();
+                std::vector<hpx::id_type> counters;
+                for (auto &id : v) {
+                    counters.push_back(id.has_exception() ? hpx::naming::invalid_id : id.get());
+                }
+                std::lock_guard<hpx::lcos::local::spinlock> lock(_mutex);
+                c->counters  = counters;
+                c->resolving = false;
+            });
+    }
+
+    // the sample is stored and formatted under the lock, written outside it
+    void record(const hpx::id_type &locality, channel &c, const sample &s)
+    {
+        int rank = hpx::naming::get_locality_id_from_id(locality);
+        std::ostringstream line;
+        bool to_file = _file.is_open();
+        {
+            std::lock_guard<hpx::lcos::local::spinlock> lock(_mutex);
+            c.samples.push(s);
+            if (to_file) {
+                line << s.time << "," << rank << "," << s.idle_rate << "," << s.flips_per_second
+                     << "," << s.completed << "," << s.best_energy << "," << s.queue_depth << "\n";
+            }
+            else {
+                boost::format formatter("Locality %s %12s, %s, %04d, %6.1f[s], %5.2f%%, flips/s, %10.4g\n");
+                line << (formatter % locality % "Ready" % " idle-rate" % c.samples.size()
+                    % s.time % s.idle_rate % s.flips_per_second);
+            }
+        }
+        if (to_file) {
+            std::lock_guard<hpx::lcos::local::mutex> lock(_file_mutex);
+            if (_file.is_open()) {
+                _file << line.str();
+                _file.flush();
+            }
+        }
+        else {
+            std::cout << line.str();
+        }
+    }
+
+    std::atomic<bool>                   _running;
+    boost::uint64_t                     _cadence;
+    std::size_t                         _capacity;
+    locality_source                     _localities;
+    hpx::future<void>                   _loop;
+    hpx::lcos::local::spinlock          _mutex;
+    std::map<hpx::id_type, channel>     _channels;
+    // the file is only written with _file_mutex held
+    hpx::lcos::local::mutex             _file_mutex;
+    std::ofstream                       _file;
+};
+
+#endif
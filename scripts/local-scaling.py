@@ -0,0 +1,150 @@
+#!/usr/bin/env python
+#
+# Strong/weak scaling driver for spinsolve on a single Linux box.
+#
+# Replaces the slurm-benchmark.sh jobs for day to day regression checks:
+# N localities are started as N local processes (HPX TCP parcelport, one port
+# per locality), and the driver sweeps
+#     executables x localities x threads x repetitions x Ns x trials
+# For each run it collects the CSVData line printed by rank 0 and the idle-rate
+# lines of the monitor, and writes one CSVData line per run, extended with
+# solves/s, parallel efficiency and mean idle-rate :
+#
+#   CSVData , Ns, 5000, num_rep, 200, nodes, 1, threads, 2, Calculation_time, 108.8,
+#             solves_per_second, 1.84, efficiency, 0.98, idle_rate, 1.5, config, sharedH, trial, 0
+#
+# so the result files can be pasted into the 2015 spreadsheets next to the
+# cluster numbers.
+#
+# example, comparing a normal build against one configured with
+# -DSPINSOLVE_UNIQUE_HAMILTONIAN=ON (the sharedH/uniqueH benchmarks)
+#   python scripts/local-scaling.py \
+#       --exe sharedH=build/bin/spinsolve --exe uniqueH=build-unique/bin/spinsolve \
+#       --localities 1,2 --threads 1,2,4 --reps-per-thread 20 --Ns 1000 --csv scaling.csv
+#
+from __future__ import print_function
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import time
+
+csv_re  = re.compile(r'CSVData\s*,\s*Ns,\s*(\d+),\s*num_rep,\s*(\d+),\s*nodes,\s*(\d+),'
+                     r'\s*threads,\s*(\d+),\s*Calculation_time,\s*([0-9.eE+-]+)')
+idle_re = re.compile(r'idle-rate,\s*\d+,\s*[0-9.]+\[s\],\s*([0-9.]+)%')
+
+def int_list(text):
+    return [int(x) for x in text.split(',') if x]
+
+def parse_args():
+    source_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    p = argparse.ArgumentParser(description='Local multi-locality scaling benchmark for spinsolve')
+    p.add_argument('--exe', action='append', default=[],
+                   help='label=path of a spinsolve executable, may be repeated (default spinsolve=bin/spinsolve)')
+    p.add_argument('--localities', type=int_list, default=[1, 2], help='comma separated locality counts')
+    p.add_argument('--threads', type=int_list, default=[1, 2], help='comma separated threads per locality')
+    p.add_argument('--Ns', type=int_list, default=[1000], help='comma separated sweeps per repetition')
+    p.add_argument('--repetitions', type=int_list, default=[],
+                   help='comma separated total repetitions (strong scaling)')
+    p.add_argument('--reps-per-thread', type=int, default=0,
+                   help='repetitions per worker thread (weak scaling, used if --repetitions is not given)')
+    p.add_argument('--trials', type=int, default=1, help='runs of every configuration')
+    p.add_argument('--input', default=os.path.join(source_dir, 'testdata', 'Instances128Spins', 'lattice', '128random0.lat'))
+    p.add_argument('--port', type=int, default=7910, help='first TCP port, locality k uses port+k')
+    p.add_argument('--timeout', type=float, default=3600.0, help='seconds before a run is killed')
+    p.add_argument('--workdir', default='local-scaling', help='directory for outputs and logs')
+    p.add_argument('--csv', default='', help='append CSVData lines to this file')
+    p.add_argument('--extra', default='', help='extra arguments passed to every locality')
+    args = p.parse_args()
+    if not args.exe:
+        args.exe = ['spinsolve=bin/spinsolve']
+    if not args.repetitions and not args.reps_per_thread:
+        args.reps_per_thread = 20
+    return args
+
+def run_once(args, exe, localities, threads, num_rep, Ns, tag):
+    """start all localities, wait for rank 0, return (calc_time, mean idle rate)"""
+    outfile = os.path.join(args.workdir, tag + '.out')
+    agas = '127.0.0.1:%d' % args.port
+    procs = []
+    logs = []
+    for node in range(localities):
+        cmd = [exe,
+               '--hpx:threads=%d' % threads,
+               '--repetitions=%d' % num_rep,
+               '--Ns=%d' % Ns,
+               '--input=%s' % args.input,
+               '--output=%s' % outfile]
+        if localities > 1:
+            cmd += ['--hpx:localities=%d' % localities,
+                    '--hpx:node=%d' % node,
+                    '--hpx:agas=%s' % agas,
+                    '--hpx:hpx=127.0.0.1:%d' % (args.port + node),
+                    '-Ihpx.parcel.tcp.enable=1']
+        cmd += args.extra.split()
+        log = open(os.path.join(args.workdir, '%s.rank%d.log' % (tag, node)), 'w')
+        logs.append(log)
+        procs.append(subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT,
+                                      stdin=subprocess.DEVNULL if hasattr(subprocess, 'DEVNULL') else None))
+
+    start = time.time()
+    while procs[0].poll() is None and time.time() - start < args.timeout:
+        time.sleep(0.2)
+    for p in procs:
+        if p.poll() is None:
+            p.kill()
+        p.wait()
+    for log in logs:
+        log.close()
+
+    with open(os.path.join(args.workdir, '%s.rank0.log' % tag)) as f:
+        text = f.read()
+    match = csv_re.search(text)
+    if not match:
+        return None, None
+    idle = [float(x) for x in idle_re.findall(text)]
+    return float(match.group(5)), (sum(idle) / len(idle) if idle else float('nan'))
+
+def main():
+    args = parse_args()
+    if not os.path.isdir(args.workdir):
+        os.makedirs(args.workdir)
+    csv = open(args.csv, 'a') if args.csv else None
+
+    for spec in args.exe:
+        label, _, exe = spec.partition('=')
+        if not exe:
+            label, exe = os.path.basename(spec), spec
+        for Ns in args.Ns:
+            # efficiency is relative to the smallest configuration of this exe/Ns
+            baseline = None
+            for localities in args.localities:
+                for threads in args.threads:
+                    workers = localities * threads
+                    reps = args.repetitions or [args.reps_per_thread * workers]
+                    for num_rep in reps:
+                        for trial in range(args.trials):
+                            tag = '%s-N%d-l%d-t%d-r%d-%d' % (label, Ns, localities, threads, num_rep, trial)
+                            calc, idle = run_once(args, exe, localities, threads, num_rep, Ns, tag)
+                            if calc is None:
+                                print('run %s failed, see %s' % (tag, args.workdir), file=sys.stderr)
+                                continue
+                            rate = num_rep / calc
+                            per_worker = rate / workers
+                            if baseline is None:
+                                baseline = per_worker
+                            line = ('CSVData , Ns, %d, num_rep, %d, nodes, %d, threads, %d, Calculation_time, %g'
+                                    ', solves_per_second, %g, efficiency, %.3f, idle_rate, %.2f, config, %s, trial, %d'
+                                    % (Ns, num_rep, localities, threads, calc,
+                                       rate, per_worker / baseline, idle, label, trial))
+                            print(line)
+                            if csv:
+                                csv.write(line + '\n')
+                                csv.flush()
+    if csv:
+        csv.close()
+
+if __name__ == '__main__':
+    main()
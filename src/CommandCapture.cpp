@@ -36,8 +36,15 @@ void DisplayCommand(const std::string &fullcommandline)
 }
 //---------------------------------------------------------------------------
 std::vector<std::string> ExecuteAndCapture(const std::vector<std::string> &commands, double timeout, bool verbose)
+{
+  int exit_value;
+  return ExecuteAndCapture(commands, timeout, exit_value, verbose);
+}
+//---------------------------------------------------------------------------
+std::vector<std::string> ExecuteAndCapture(const std::vector<std::string> &commands, double timeout, int &exit_value, bool verbose)
 {
   std::vector<std::string> std_out;
+  exit_value = -1;
   std::vector<const char*> commands_with_null_term;
   std::for_each(commands.begin(), commands.end(), [&](const std::string &piece){ commands_with_null_term.push_back(piece.c_str()); });
   commands_with_null_term.push_back(0);
@@ -62,6 +69,9 @@ std::vector<std::string> ExecuteAndCapture(const std::vector<std::string> &comma
     kwsysProcess_Execute(process);
     double tout = timeout;
     kwsysProcess_WaitForExit(process, &tout);
+    if (kwsysProcess_GetState(process)==kwsysProcess_State_Exited) {
+      exit_value = kwsysProcess_GetExitValue(process);
+    }
   }
   catch (...) {}
   kwsysProcess_Delete(process);
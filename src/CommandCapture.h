@@ -7,6 +7,10 @@
 // Execute a shell/OS command and return the resulting output as a string
 std::vector<std::string> ExecuteAndCapture(const std::vector<std::string> &commands, double timeout, bool verbose=false);
 
+// As above, exit_value is the exit code of the command, or -1 if it could not
+// be run, was killed or timed out
+std::vector<std::string> ExecuteAndCapture(const std::vector<std::string> &commands, double timeout, int &exit_value, bool verbose=false);
+
 // Execute a shell/OS command and detach from it and leave it running
 void ExecuteAndDetach(const std::vector<std::string> &commands, bool verbose);
 
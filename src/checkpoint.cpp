@@ -0,0 +1,199 @@
+#include "checkpoint.hpp"
+#include "hamiltonian.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char magic[8] = {'S','P','I','N','C','K','P','1'};
+
+// FNV-1a, used for the record checksums
+struct fnv1a
+{
+  std::uint64_t h_ = 14695981039346656037ull;
+
+  void add(const void* data, std::size_t n) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for(std::size_t i = 0; i < n; ++i) {
+      h_ ^= p[i];
+      h_ *= 1099511628211ull;
+    }
+  }
+
+  template <class T>
+  void add(const T& value) { add(&value, sizeof(value)); }
+};
+
+// records are assembled in memory so that they can be checksummed and
+// written with a single call
+template <class T>
+void put(std::string& buf, const T& value)
+{
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <class T>
+bool get(std::istream& in, T& value, fnv1a& sum)
+{
+  if(!in.read(reinterpret_cast<char*>(&value), sizeof(value)))
+    return false;
+  sum.add(value);
+  return true;
+}
+
+void put_checksum(std::string& buf)
+{
+  fnv1a sum;
+  sum.add(buf.data(), buf.size());
+  put(buf, sum.h_);
+}
+
+bool checksum_ok(std::istream& in, const fnv1a& sum)
+{
+  std::uint64_t stored;
+  return in.read(reinterpret_cast<char*>(&stored), sizeof(stored)) && stored == sum.h_;
+}
+
+std::string header_record(const checkpoint_header& h)
+{
+  std::string buf(magic, sizeof(magic));
+  put(buf, h.hamiltonian_hash);
+  put(buf, h.spins);
+  put(buf, h.num_rep);
+  put(buf, h.Ns);
+  put(buf, h.beta0);
+  put(buf, h.beta1);
+  put_checksum(buf);
+  return buf;
+}
+
+std::string results_record(const std::vector<result>& results, std::uint64_t spins,
+                           std::uint64_t next_seed, double elapsed)
+{
+  std::string buf;
+  put(buf, std::uint64_t(results.size()));
+  put(buf, next_seed);
+  put(buf, elapsed);
+  const std::size_t bytes = (spins + 7)/8;
+  for(const auto& r : results) {
+    put(buf, r.seed_);
+    put(buf, r.E_);
+    std::string packed(bytes, '\0');
+    for(std::size_t i = 0; i < spins; ++i)
+      if(r.spins_[i])
+        packed[i/8] |= char(1 << (i%8));
+    buf += packed;
+  }
+  put_checksum(buf);
+  return buf;
+}
+
+}
+
+checkpoint_header::checkpoint_header(const hamiltonian_type& H, std::uint64_t num_rep_,
+                                     std::uint64_t Ns_, double beta0_, double beta1_)
+  : hamiltonian_hash(H.content_hash()), spins(H.size())
+  , num_rep(num_rep_), Ns(Ns_), beta0(beta0_), beta1(beta1_)
+{
+}
+
+bool checkpoint_header::operator == (const checkpoint_header& other) const
+{
+  return hamiltonian_hash == other.hamiltonian_hash && spins == other.spins
+      && num_rep == other.num_rep && Ns == other.Ns
+      && beta0 == other.beta0 && beta1 == other.beta1;
+}
+
+std::vector<std::pair<std::uint64_t, std::uint64_t>> checkpoint_state::completed_ranges() const
+{
+  std::vector<std::uint64_t> seeds;
+  for(const auto& r : results)
+    seeds.push_back(r.seed_);
+  std::sort(seeds.begin(), seeds.end());
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+  for(const auto s : seeds) {
+    if(!ranges.empty() && s <= ranges.back().second + 1)
+      ranges.back().second = std::max(ranges.back().second, s);
+    else
+      ranges.push_back(std::make_pair(s, s));
+  }
+  return ranges;
+}
+
+checkpoint_writer::checkpoint_writer(const std::string& filename, const checkpoint_header& header,
+                                     const std::vector<result>& completed,
+                                     std::uint64_t next_seed, double elapsed)
+  : filename_(filename), header_(header)
+{
+  const std::string tmp = filename_ + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out << header_record(header_);
+    if(!completed.empty())
+      out << results_record(completed, header_.spins, next_seed, elapsed);
+    if(!out)
+      throw std::runtime_error("cannot write checkpoint " + tmp);
+  }
+  if(std::rename(tmp.c_str(), filename_.c_str()) != 0)
+    throw std::runtime_error("cannot rename checkpoint " + tmp + " to " + filename_);
+  out_.open(filename_, std::ios::binary | std::ios::app);
+}
+
+void checkpoint_writer::write(const std::vector<result>& results, std::uint64_t next_seed, double elapsed)
+{
+  out_ << results_record(results, header_.spins, next_seed, elapsed);
+  out_.flush();
+}
+
+checkpoint_state read_checkpoint(const std::string& filename)
+{
+  std::ifstream in(filename, std::ios::binary);
+  if(!in)
+    throw std::runtime_error("cannot open checkpoint " + filename);
+
+  checkpoint_state state;
+  checkpoint_header& h = state.header;
+  char m[sizeof(magic)];
+  fnv1a sum;
+  if(!in.read(m, sizeof(m)) || std::memcmp(m, magic, sizeof(magic)) != 0)
+    throw std::runtime_error(filename + " is not a checkpoint file");
+  sum.add(m, sizeof(m));
+  if(!(get(in, h.hamiltonian_hash, sum) && get(in, h.spins, sum) && get(in, h.num_rep, sum)
+       && get(in, h.Ns, sum) && get(in, h.beta0, sum) && get(in, h.beta1, sum)
+       && checksum_ok(in, sum)))
+    throw std::runtime_error("corrupt checkpoint header in " + filename);
+
+  // read records until the end of the file or the first incomplete one
+  const std::size_t bytes = (h.spins + 7)/8;
+  std::string packed(bytes, '\0');
+  while(in.peek() != EOF) {
+    fnv1a rsum;
+    std::uint64_t count, next_seed;
+    double elapsed;
+    if(!(get(in, count, rsum) && get(in, next_seed, rsum) && get(in, elapsed, rsum)))
+      break;
+    std::vector<result> records;
+    bool complete = true;
+    for(std::uint64_t k = 0; k < count && complete; ++k) {
+      result r;
+      complete = get(in, r.seed_, rsum) && get(in, r.E_, rsum)
+        && in.read(&packed[0], bytes);
+      if(!complete)
+        break;
+      rsum.add(packed.data(), bytes);
+      r.spins_.resize(h.spins);
+      for(std::size_t i = 0; i < h.spins; ++i)
+        r.spins_[i] = (packed[i/8] >> (i%8)) & 1;
+      records.push_back(std::move(r));
+    }
+    if(!complete || !checksum_ok(in, rsum))
+      break;
+    for(auto& r : records)
+      state.results.push_back(std::move(r));
+    state.next_seed = next_seed;
+    state.elapsed   = elapsed;
+  }
+  return state;
+}
@@ -0,0 +1,75 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "result.hpp"
+
+class hamiltonian_type;
+
+/// the parameters of a run, a checkpoint can only be resumed by a run with
+/// the same hamiltonian, schedule and number of repetitions
+struct checkpoint_header
+{
+  std::uint64_t hamiltonian_hash = 0;
+  std::uint64_t spins            = 0;
+  std::uint64_t num_rep          = 0;
+  std::uint64_t Ns               = 0;
+  double        beta0            = 0;
+  double        beta1            = 0;
+
+  checkpoint_header() {}
+  checkpoint_header(const hamiltonian_type&, std::uint64_t num_rep,
+                    std::uint64_t Ns, double beta0, double beta1);
+
+  bool operator == (const checkpoint_header&) const;
+  bool operator != (const checkpoint_header& other) const { return !(*this == other); }
+};
+
+/// everything read back from a checkpoint file
+struct checkpoint_state
+{
+  checkpoint_header header;
+
+  /// completed repetitions, spins and energy but no solver statistics
+  std::vector<result> results;
+
+  /// scheduler state of the last record: the next seed the master would have
+  /// issued and the calculation time spent up to then
+  std::uint64_t next_seed = 0;
+  double        elapsed   = 0;
+
+  /// the completed seeds as [first, last] ranges
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> completed_ranges() const;
+};
+
+/// Appends completed repetitions to a compact binary checkpoint file:
+/// a header followed by records of (seed, energy, bit packed spins) and the
+/// scheduler state, each record closed by a checksum so that a record cut
+/// short by a crash is dropped on reading. write() flushes every record.
+class checkpoint_writer
+{
+public:
+  /// (re)creates the file with the given results as its first record,
+  /// written to a temporary file and renamed so an old checkpoint is never lost
+  checkpoint_writer(const std::string& filename, const checkpoint_header&,
+                    const std::vector<result>& completed = std::vector<result>(),
+                    std::uint64_t next_seed = 0, double elapsed = 0);
+
+  void write(const std::vector<result>& results, std::uint64_t next_seed, double elapsed);
+
+  const std::string& filename() const { return filename_; }
+
+private:
+  std::string       filename_;
+  checkpoint_header header_;
+  std::ofstream     out_;
+};
+
+/// reads a checkpoint, throws std::runtime_error if it is missing or not a checkpoint
+checkpoint_state read_checkpoint(const std::string& filename);
+
+#endif
@@ -1,17 +1,29 @@
 #include "hamiltonian.hpp"
+#include <stdexcept>
+#include <unordered_map>
 
 hamiltonian_type::hamiltonian_type(const std::string& file_name)
 {
-  std::unordered_set<std::string> edge_set;
-
   std::ifstream in(file_name);
   assert(in);
+  read(in);
+}
+
+hamiltonian_type::hamiltonian_type(std::istream& in)
+{
+  read(in);
+}
+
+void hamiltonian_type::read(std::istream& in)
+{
+  std::unordered_set<std::string> edge_set;
 
   std::size_t N(0);
   std::map<std::string,unsigned> index;
 
   std::size_t count(0);
   std::vector<edge_type> edges;
+  integral_ = true;
   while(in){
 
     std::string input_str;
@@ -36,6 +48,9 @@ hamiltonian_type::hamiltonian_type(const std::string& file_name)
 
         edge.second = val;
 
+        if(val != std::floor(val) || std::abs(val) > 32767.0)
+          integral_ = false;
+
         for(unsigned i = 0; i < input.size()-1; ++i){
           const std::string site(input[i]);
           if(index.find(site) == index.end())
@@ -58,7 +73,18 @@ hamiltonian_type::hamiltonian_type(const std::string& file_name)
 
     ++count;
   }
-  in.close();
+
+  // keep the site names so results can be written in the original labelling
+  std::vector<const std::string*> names(N);
+  for(const auto& site : index)
+    names[site.second] = &site.first;
+
+  label_offsets_.reserve(N+1);
+  label_offsets_.push_back(0);
+  for(const auto name : names){
+    label_pool_ += *name;
+    label_offsets_.push_back(label_pool_.size());
+  }
 
   nodes_.resize(N);
 
@@ -76,3 +102,121 @@ hamiltonian_type::hamiltonian_type(const std::string& file_name)
   }
 }
 
+
+std::vector<unsigned> hamiltonian_type::label_order() const
+{
+  std::vector<std::string> names(size());
+  std::vector<bool> numeric(size());
+  for(unsigned i = 0; i < size(); ++i){
+    names[i] = label(i);
+    numeric[i] = !names[i].empty() &&
+      std::all_of(names[i].begin(),names[i].end(),[](char c){return c >= '0' && c <= '9';});
+  }
+
+  std::vector<unsigned> order(size());
+  for(unsigned i = 0; i < order.size(); ++i)
+    order[i] = i;
+
+  std::stable_sort(order.begin(),order.end(),[&](unsigned a, unsigned b){
+    // numbers before names, shorter numbers first, otherwise lexicographic
+    if(numeric[a] != numeric[b])
+      return bool(numeric[a]);
+    if(numeric[a] && names[a].size() != names[b].size())
+      return names[a].size() < names[b].size();
+    return names[a] < names[b];
+  });
+
+  return order;
+}
+
+std::uint64_t hamiltonian_type::content_hash() const
+{
+  // FNV-1a over the terms of every spin and the labels
+  std::uint64_t h(14695981039346656037ull);
+  auto add = [&h](const void* data, std::size_t n){
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for(std::size_t i = 0; i < n; ++i){
+      h ^= p[i];
+      h *= 1099511628211ull;
+    }
+  };
+  for(const auto& node : nodes_){
+    const std::uint64_t terms(node.size());
+    add(&terms, sizeof(terms));
+    for(const auto& edge : node){
+      add(edge.first.data(), edge.first.size()*sizeof(unsigned));
+      add(&edge.second, sizeof(edge.second));
+    }
+  }
+  add(label_pool_.data(), label_pool_.size());
+  add(label_offsets_.data(), label_offsets_.size()*sizeof(unsigned));
+  return h;
+}
+
+hamiltonian_delta::hamiltonian_delta(std::istream& in)
+{
+  std::string line;
+  while(std::getline(in, line)){
+    std::istringstream fields(line.substr(0, line.find('#')));
+    std::vector<std::string> input;
+    std::string s;
+    while(fields >> s)
+      input.push_back(s);
+    if(input.size() < 2) continue;
+
+    term t;
+    t.value = std::stod(input.back());
+    t.sites.assign(input.begin(), input.end()-1);
+    terms.push_back(t);
+  }
+}
+
+std::size_t hamiltonian_type::apply(const hamiltonian_delta& delta)
+{
+  std::unordered_map<std::string,unsigned> index;
+  for(unsigned i = 0; i < size(); ++i)
+    index[label(i)] = i;
+
+  std::size_t changed(0);
+  for(const auto& t : delta.terms){
+    std::vector<unsigned> sites;
+    for(const auto& name : t.sites){
+      const auto it = index.find(name);
+      if(it == index.end())
+        throw std::invalid_argument("delta for unknown site '" + name + "'");
+      sites.push_back(it->second);
+    }
+    if(sites.empty()) continue;
+    std::sort(sites.begin(),sites.end(),std::less<unsigned>());
+
+    // a term is stored once with every distinct spin it contains
+    std::vector<unsigned> owners(sites);
+    owners.erase(std::unique(owners.begin(),owners.end()),owners.end());
+    auto find = [&sites](node_type& node){
+      return std::find_if(node.begin(),node.end(),[&sites](const edge_type& e){return e.first == sites;});
+    };
+
+    const auto current = find(nodes_[owners[0]]);
+    const bool exists(current != nodes_[owners[0]].end());
+    if(exists ? current->second == t.value : t.value == 0.0) continue;
+    ++changed;
+
+    for(const auto a : owners){
+      const auto e = find(nodes_[a]);
+      if(t.value == 0.0)
+        nodes_[a].erase(e);
+      else if(e != nodes_[a].end())
+        e->second = t.value;
+      else
+        nodes_[a].push_back(edge_type(sites, t.value));
+    }
+  }
+
+  integral_ = true;
+  for(const auto& node : nodes_)
+    for(const auto& edge : node)
+      if(edge.second != std::floor(edge.second) || std::abs(edge.second) > 32767.0)
+        integral_ = false;
+
+  return changed;
+}
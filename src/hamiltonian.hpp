@@ -10,6 +10,8 @@
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
 
 template <class T>
 std::string tostring(const std::vector<T>& vec)
@@ -21,6 +23,35 @@ std::string tostring(const std::vector<T>& vec)
   return str;
 }
 
+// A change of some terms of a hamiltonian, by site label: each term gets the
+// new value, 0 removes it, and a term that does not exist yet is added.
+// Read from lines "site site ... value" as in the input files.
+struct hamiltonian_delta {
+  struct term {
+    std::vector<std::string> sites;
+    double value;
+
+    template <typename Archive>
+    void serialize(Archive & ar, unsigned)
+    {
+        ar & sites & value;
+    }
+  };
+
+  std::vector<term> terms;
+
+  hamiltonian_delta() {}
+  hamiltonian_delta(std::istream&);
+
+  bool empty() const {return terms.empty();}
+
+  template <typename Archive>
+  void serialize(Archive & ar, unsigned)
+  {
+      ar & terms;
+  }
+};
+
 class hamiltonian_type {
 // Stores the Hamiltonian of the spin glass
   typedef std::pair<std::vector<unsigned>,double> edge_type;
@@ -28,18 +59,29 @@ class hamiltonian_type {
 
 public:
 
-  hamiltonian_type() {};
+  hamiltonian_type() : integral_(false) {};
 
   // construct with filname containing hamiltonian
   hamiltonian_type(const std::string&);
 
+  // construct from a stream in the same format
+  hamiltonian_type(std::istream&);
+
   // copy constructor
-  hamiltonian_type(const hamiltonian_type &other) : nodes_(other.nodes_) {
+  hamiltonian_type(const hamiltonian_type &other)
+    : nodes_(other.nodes_)
+    , label_pool_(other.label_pool_)
+    , label_offsets_(other.label_offsets_)
+    , integral_(other.integral_) {
 //    std::cout << "Copy constructor of hamiltonian" << std::endl;
   };
 
   // for efficient hpx forwarding, a move constructor is preffered
-  hamiltonian_type(hamiltonian_type &&other) : nodes_(std::move(other.nodes_)) {
+  hamiltonian_type(hamiltonian_type &&other)
+    : nodes_(std::move(other.nodes_))
+    , label_pool_(std::move(other.label_pool_))
+    , label_offsets_(std::move(other.label_offsets_))
+    , integral_(other.integral_) {
 //    std::cout << "Move constructor of hamiltonian" << std::endl;
   };
 
@@ -48,15 +90,67 @@ public:
   node_type& operator[](const unsigned i) {return nodes_[i];}
   const node_type& operator[](const unsigned i) const {return nodes_[i];}
 
+  // true if every coupling is an integer that fits a 16 bit coupling,
+  // the solver then uses exact integer arithmetic
+  bool integral() const {return integral_;}
+
+  // the largest number of terms any spin takes part in
+  std::size_t max_degree() const {
+    std::size_t d(0);
+    for(const auto& node : nodes_)
+      d = std::max(d, node.size());
+    return d;
+  }
+
+  // true if every term couples exactly two distinct spins
+  bool pairwise() const {
+    for(const auto& node : nodes_)
+      for(const auto& edge : node)
+        if(edge.first.size() != 2 || edge.first[0] == edge.first[1])
+          return false;
+    return true;
+  }
+
+  // original site name (as found in the input file) of internal index i
+  std::string label(const unsigned i) const {
+    if(label_offsets_.empty()) return std::to_string(i);
+    return label_pool_.substr(label_offsets_[i], label_offsets_[i+1] - label_offsets_[i]);
+  }
+
+  // internal indices sorted by their original site label,
+  // integer labels are compared numerically
+  std::vector<unsigned> label_order() const;
+
+  // change terms in place, throws std::invalid_argument for a site that is
+  // not in the hamiltonian (a delta cannot add spins); returns the number of
+  // terms that changed
+  std::size_t apply(const hamiltonian_delta&);
+
+  // hash of the couplings and site labels, identifies an instance
+  // independent of where it was loaded from
+  std::uint64_t content_hash() const;
+
   template <typename Archive>
   void serialize(Archive & ar, unsigned)
   {
       ar & nodes_;
+      ar & label_pool_;
+      ar & label_offsets_;
+      ar & integral_;
   }
 
 private:
 
+  void read(std::istream&);
+
   std::vector<node_type> nodes_;
+
+  // site labels of the input file, packed into one string,
+  // label i is label_pool_[label_offsets_[i], label_offsets_[i+1])
+  std::string label_pool_;
+  std::vector<unsigned> label_offsets_;
+
+  bool integral_;
 };
 
 #endif
@@ -0,0 +1,213 @@
+//----------------------------------------------------------------------------
+// Stress test of the lock-free structures of the solver wrapper scheduler
+// (async/lockfree_queues.hpp) with concurrent producers and consumers.
+// Does not need HPX, plain std::threads stand in for the spawn loop, the
+// continuations of the solve steps and the collector.
+//
+// example command line
+//   spinsolve_lockfree_stress --items 1000000 --producers 8
+// Checks that
+//   spsc_ring   every item arrives once and in order, through a small ring
+//   mpsc_queue  every item of every producer arrives once, each producer's
+//               items in the order it pushed them
+//   cow_list    readers following a list that a writer keeps republishing
+//               only ever see complete lists, never an older one than before
+// Returns 0 if all checks pass, 1 otherwise.
+//----------------------------------------------------------------------------
+
+// STL includes
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "lockfree_queues.hpp"
+
+using spinsolver::lockfree::spsc_ring;
+using spinsolver::lockfree::mpsc_queue;
+using spinsolver::lockfree::cow_list;
+
+namespace {
+
+int failures = 0;
+
+void check(const bool ok, const std::string& what)
+{
+  if(!ok){
+    ++failures;
+    std::cout << "FAILED: " << what << std::endl;
+  }
+}
+
+//----------------------------------------------------------------------------
+// one producer, one consumer, a ring much smaller than the item count so
+// that both sides keep finding it full or empty
+//----------------------------------------------------------------------------
+void stress_spsc(const std::uint64_t items)
+{
+  spsc_ring<std::uint64_t> ring(64);
+  std::thread producer([&ring, items](){
+    for(std::uint64_t i = 0; i < items; ++i)
+      while(!ring.push(i)) std::this_thread::yield();
+  });
+
+  std::uint64_t expected(0);
+  bool in_order(true);
+  while(expected < items){
+    std::uint64_t value;
+    if(!ring.pop(value)){
+      std::this_thread::yield();
+      continue;
+    }
+    if(value != expected) in_order = false;
+    ++expected;
+  }
+  producer.join();
+
+  std::uint64_t extra;
+  check(in_order, "spsc_ring delivers the items in order");
+  check(!ring.pop(extra), "spsc_ring is empty after all items were popped");
+  std::cout << "spsc_ring   " << items << " items" << std::endl;
+}
+
+//----------------------------------------------------------------------------
+// several producers, one consumer, the items are (producer, sequence) pairs
+//----------------------------------------------------------------------------
+void stress_mpsc(const std::uint64_t items, const unsigned producers)
+{
+  typedef std::pair<unsigned, std::uint64_t> item_type;
+  std::unique_ptr<mpsc_queue<item_type> > queue(new mpsc_queue<item_type>());
+  std::atomic<unsigned> started(0);
+
+  std::vector<std::thread> threads;
+  for(unsigned p = 0; p < producers; ++p)
+    threads.push_back(std::thread([&queue, &started, p, items, producers](){
+      // start together so that the pushes overlap
+      ++started;
+      while(started < producers) std::this_thread::yield();
+      for(std::uint64_t i = 0; i < items; ++i)
+        queue->push(item_type(p, i));
+    }));
+
+  std::vector<std::uint64_t> next(producers, 0);
+  std::uint64_t received(0);
+  bool in_order(true);
+  while(received < items*producers){
+    item_type value;
+    if(!queue->pop(value)){
+      std::this_thread::yield();
+      continue;
+    }
+    if(value.first >= producers || value.second != next[value.first])
+      in_order = false;
+    else
+      ++next[value.first];
+    ++received;
+  }
+  for(auto& t : threads) t.join();
+
+  item_type extra;
+  check(in_order, "mpsc_queue delivers every item once, in order per producer");
+  check(!queue->pop(extra), "mpsc_queue is empty after all items were popped");
+
+  // the destructor frees items that were never popped
+  for(unsigned i = 0; i < 1000; ++i)
+    queue->push(item_type(0, i));
+  queue.reset();
+  std::cout << "mpsc_queue  " << producers << " producers x " << items << " items" << std::endl;
+}
+
+//----------------------------------------------------------------------------
+// one writer republishing the list, several readers refreshing their
+// snapshot. Version v of the list has v%8+1 entries, all holding v.
+//----------------------------------------------------------------------------
+void stress_cow(const std::uint64_t versions, const unsigned readers)
+{
+  typedef cow_list<std::shared_ptr<const std::uint64_t> > list_type;
+  list_type list;
+  std::atomic<bool> done(false);
+  std::atomic<unsigned> torn(0), older(0);
+  std::atomic<std::uint64_t> refreshed(0);
+
+  std::vector<std::thread> threads;
+  for(unsigned r = 0; r < readers; ++r)
+    threads.push_back(std::thread([&](){
+      std::shared_ptr<const list_type::list_type> snapshot;
+      std::uint64_t epoch(~std::uint64_t(0));
+      std::uint64_t last(0);
+      while(!done){
+        if(!list.refresh(snapshot, epoch)) continue;
+        ++refreshed;
+        if(snapshot->empty()) continue;
+        const std::uint64_t v(*snapshot->front());
+        if(snapshot->size() != v%8+1) ++torn;
+        for(const auto& e : *snapshot)
+          if(!e || *e != v) ++torn;
+        if(v < last) ++older;
+        last = v;
+      }
+    }));
+
+  for(std::uint64_t v = 1; v <= versions; ++v){
+    std::shared_ptr<list_type::list_type> next(std::make_shared<list_type::list_type>());
+    for(std::uint64_t k = 0; k < v%8+1; ++k)
+      next->push_back(std::make_shared<const std::uint64_t>(v));
+    list.publish(next);
+    // let the readers in now and then when there are fewer cores than threads
+    if(v%64 == 0) std::this_thread::yield();
+  }
+  done = true;
+  for(auto& t : threads) t.join();
+
+  check(torn == 0, "cow_list readers only see complete lists");
+  check(older == 0, "cow_list readers never go back to an older list");
+  check(list.epoch() == versions, "cow_list epoch counts the publications");
+  check(*list.snapshot()->front() == versions, "cow_list holds the last list published");
+  std::cout << "cow_list    " << versions << " versions, " << readers << " readers, "
+            << refreshed << " refreshes" << std::endl;
+}
+
+std::uint64_t parse_count(const std::string& s)
+{
+  return std::stoull(s);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  std::uint64_t items = 1000000;
+  unsigned producers = std::max(2u, std::thread::hardware_concurrency());
+
+  for (int i=1; i<argc; ++i) {
+    const std::string arg(argv[i]);
+    if (arg == "--help" || arg == "-h") {
+      std::cout << "Usage: spinsolve_lockfree_stress [options]\n"
+                << "  --items <n>      items per producer (default 1000000)\n"
+                << "  --producers <n>  producer (and reader) threads (default: hardware threads, at least 2)\n";
+      return 0;
+    }
+    else if (arg == "--items" && i+1<argc)      items = parse_count(argv[++i]);
+    else if (arg == "--producers" && i+1<argc)  producers = unsigned(parse_count(argv[++i]));
+    else {
+      std::cerr << "error: invalid option '" << arg << "'" << std::endl;
+      return 1;
+    }
+  }
+
+  stress_spsc(items);
+  stress_mpsc(items, producers);
+  stress_cow(items/10, producers);
+
+  if(failures){
+    std::cout << failures << " check(s) failed" << std::endl;
+    return 1;
+  }
+  std::cout << "all checks passed" << std::endl;
+  return 0;
+}
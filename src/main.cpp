@@ -6,10 +6,10 @@
 #include <hpx/util/asio_util.hpp>
 #include <hpx/lcos/local/dataflow.hpp>
 #include <hpx/lcos/local/mutex.hpp>
+#include <hpx/lcos/local/promise.hpp>
 #include <hpx/lcos/local/shared_mutex.hpp>
 //
 #include <hpx/parallel/execution_policy.hpp>
-#include "hpx/runtime/threads/executors/thread_pool_os_executors.hpp"
 //
 // Boost includes
 #include <boost/program_options.hpp>
@@ -24,16 +24,28 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <cstdlib>
+#include <limits>
 
 // Solver related includes
 #include "spin_glass_solver_defines.h"
 #include "hamiltonian.hpp"
 #include "result.hpp"
 #include "sa_solver.hpp"
+#include "checkpoint.hpp"
+#include "warm_start.hpp"
 
 // Wrapping solver in an HPX framework
 #include "solver_wrapper.hpp"
 #include "solver_manager.hpp"
+#include "solver_counters.hpp"
+#include "telemetry.hpp"
+#include "job_service.hpp"
+#include "instance_cache.hpp"
+#include "autoscaler.hpp"
+#include "failure_detector.hpp"
+#include "provisioner.hpp"
+#include "portfolio.hpp"
 //
 #include "CommandCapture.h"
 //#define RDMAHELPER_DISABLE_LOGGING 1
@@ -58,20 +70,6 @@ template class static_queue_scheduler<
 // use --help to get this program help
 // use --hpx:help to get help on all options including hpx options
 
-//----------------------------------------------------------------------------
-// utility, get the counter id for a given name and locality
-//----------------------------------------------------------------------------
-const std::string counter_template = "/threads{locality#*/total}/idle-rate";
-//
-hpx::future<hpx::id_type> get_counter(std::string countername, const hpx::id_type &locality)
-{
-    int rank = hpx::naming::get_locality_id_from_id(locality);
-    std::string replacement = "#" + boost::lexical_cast<std::string>(rank);
-    boost::replace_all(countername, "#*", replacement);
-    hpx::future<hpx::id_type> id = hpx::performance_counters::get_counter_async(countername);
-    return id;
-}
-
 //----------------------------------------------------------------------------
 // Global vars and defs, Temporary, will be moved into classes...
 //----------------------------------------------------------------------------
@@ -110,9 +108,12 @@ namespace spinsolver {
     struct locality_data {
         status          state;
         hpx::id_type    solver_wrapper;
-        hpx::id_type    idle_counter;
         std::size_t     num_worker_threads;
-        double          last_idle_rate;
+        // allocation the locality runs in (SPINSOLVE_ALLOCATION for the
+        // local test backend, else SLURM_JOB_ID), empty if none
+        std::string     allocation;
+        // its tabu wrapper when the tabu engine runs
+        hpx::id_type    tabu_wrapper;
     };
     //
     hpx::id_type                            here;
@@ -130,16 +131,45 @@ namespace spinsolver {
     std::string                             partition;
     std::string                             account;
     std::string                             reservation;
+    // seconds a drained locality may take to finish its steps in flight
+    double                                  drain_timeout;
+    // slurm job of rank 0, localities of other jobs were added later
+    std::string                             allocation;
     //
-    std::shared_ptr<hamiltonian_type> hamiltonian;
+    std::shared_ptr<const hamiltonian_type> hamiltonian;
+    uint64_t                          hamiltonian_hash;
+    // set by hpx_main once the input is cached and the solver options are
+    // complete, localities that connect earlier wait for it
+    hpx::lcos::local::promise<void>   input_loaded;
+    hpx::shared_future<void>          input_ready = input_loaded.get_future();
+    // engines and kernel options of the solvers, sent to every locality
+    // with the instance
+    solver_config                     solver_options;
+    // localities that connected and wait to be initialized as one batch
+    hpx::lcos::local::spinlock          pending_mutex;
+    std::vector<hpx::id_type>           pending_nodes;
     // on each node, we have one solver_manager instance
     solver_manager                      scheduler;
+    // counter sampling, only started on rank 0
+    telemetry_service                   telemetry;
+    // job queue of the --service mode, only on rank 0
+    job_service                         service;
+    // adds and drains slurm allocations with --autoscale, only on rank 0
+    autoscaler                          autoscale;
+    // heartbeats of the solving localities, only on rank 0
+    failure_detector                    heartbeats;
+    // requests and releases nodes from the batch system, only on rank 0
+    provisioning::provisioner           batch;
+    // a heartbeat may take this many times the measured step time, and no
+    // less than heartbeat_timeout seconds
+    double                              heartbeat_timeout;
+    double                              heartbeat_factor = 4.0;
 }
 
 //----------------------------------------------------------------------------
 // Create solver wrapper and register it with the runtime
 //----------------------------------------------------------------------------
-int initialize_solver_wrapper(const hamiltonian_type &H)
+int initialize_solver_wrapper(uint64_t instance, const solver_config &options)
 {
     // useful vars that each node can keep a copy of
     spinsolver::here        = hpx::find_here();
@@ -151,8 +181,8 @@ int initialize_solver_wrapper(const hamiltonian_type &H)
     spinsolver::remotes     = hpx::find_remote_localities();
     spinsolver::localities  = hpx::find_all_localities();
 
-    // setup the solver manager
-    spinsolver::scheduler.initialize(H);
+    // setup the solver manager, the instance was distributed to our cache before
+    spinsolver::scheduler.initialize(*spinsolver::instances::get(instance), options);
     //
     char const* msg = "Created Solver Wrapper from OS-thread %1% on locality %2% rank %3% hostname %4%";
     std::cout << (boost::format(msg) % spinsolver::current % hpx::get_locality_id() % spinsolver::rank % spinsolver::name.c_str()) << std::endl;
@@ -167,7 +197,8 @@ HPX_PLAIN_ACTION(initialize_solver_wrapper, initialize_solver_wrapper_action);
 //----------------------------------------------------------------------------
 // Signal our state, used by a remote node to tell use when it is ready
 //----------------------------------------------------------------------------
-int set_solver_state(const hpx::id_type &locality, spinsolver::status state)
+int set_solver_state(const hpx::id_type &locality, spinsolver::status state,
+    const std::string &allocation = "")
 {
     auto it = spinsolver::locality_states.find(locality);
     if (it!=spinsolver::locality_states.end()) {
@@ -176,18 +207,39 @@ int set_solver_state(const hpx::id_type &locality, spinsolver::status state)
     else {
         LOG_DEBUG_MSG("adding locality " << locality << " " << state);
         spinsolver::locality_states[locality] =
-                {state, hpx::naming::invalid_id, hpx::naming::invalid_id};
+                {state, hpx::naming::invalid_id, 0, allocation};
     }
     LOG_DEBUG_MSG("set_solver_state " << locality << " " << state);
     return 1;
 }
 
-int add_solver_state(const hpx::id_type &locality, spinsolver::status state)
+int connect_pending_nodes();
+
+int add_solver_state(const hpx::id_type &locality, spinsolver::status state,
+    const std::string &allocation)
 {
     LOG_DEBUG_MSG("taking state_mutex : action received from locality " << locality);
-    std::unique_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
-set_solver_state(locality, state);
+    {
+        std::unique_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+        // a newly connected locality is initialized straight away,
+        // it becomes READY when init_node has resolved its wrapper
+        set_solver_state(locality, state==spinsolver::status::CONNECTING ?
+            spinsolver::status::INITIALIZING : state, allocation);
+    }
     LOG_DEBUG_MSG("releasing state_mutex add_solver_state" << locality);
+    if (state==spinsolver::status::CONNECTING &&
+        !allocation.empty() && allocation!=spinsolver::allocation) {
+        spinsolver::batch.connected(allocation);
+        spinsolver::autoscale.connected();
+    }
+    if (state==spinsolver::status::CONNECTING) {
+        // the first locality of a batch schedules its initialization
+        std::lock_guard<hpx::lcos::local::spinlock> lock(spinsolver::pending_mutex);
+        spinsolver::pending_nodes.push_back(locality);
+        if (spinsolver::pending_nodes.size()==1) {
+            hpx::apply(&connect_pending_nodes);
+        }
+    }
     return 1;
 }
 
@@ -239,202 +291,417 @@ std::size_t get_solver_state_size()
 //----------------------------------------------------------------------------
 // Initialize the solver on a remote node
 //----------------------------------------------------------------------------
-hpx::future<int> init_node(const hpx::id_type locality)
+hpx::future<int> init_one_node(const hpx::id_type locality)
 {
     LOG_DEBUG_MSG("entering init_node for locality " << locality);
     // std::cout << "init_node for " << locality << std::endl;
     // trigger the initialize_solver action so that the locality is initialized
-    // and ready to receive work. For now we pass the Hamiltonian as a parameter, but
-    // when we start multiple solvers with different H's we will change this
+    // and ready to receive work. The Hamiltonian is already in its instance
+    // cache, so only the hash is sent
     typedef initialize_solver_wrapper_action::result_type res_type;
-    hpx::future<res_type> f_init = hpx::async<initialize_solver_wrapper_action>(locality, *spinsolver::hamiltonian);
+    hpx::future<res_type> f_init = hpx::async<initialize_solver_wrapper_action>(locality,
+        spinsolver::hamiltonian_hash, spinsolver::solver_options);
     return f_init.then(
             hpx::launch::sync,
             [=](hpx::future<res_type> fi) -> hpx::future<int>
     {
         // std::cout << "Completed remote init, setting READY state " << std::endl;
-        hpx::future<hpx::id_type> wrapper = hpx::agas::resolve_name("/solver_wrapper/" +
-                boost::lexical_cast<std::string>(hpx::naming::get_locality_id_from_id(locality)));
-        hpx::future<hpx::id_type> counter = get_counter(counter_template, locality);
-        LOG_DEBUG_MSG("requested wrapper and counter from locality " << locality);
+        std::string rank = boost::lexical_cast<std::string>(hpx::naming::get_locality_id_from_id(locality));
+        hpx::future<hpx::id_type> wrapper = hpx::agas::resolve_name("/solver_wrapper/" + rank);
+        hpx::future<hpx::id_type> tabu_wrapper = spinsolver::solver_options.with_tabu ?
+            hpx::agas::resolve_name("/tabu_solver_wrapper/" + rank) :
+            hpx::make_ready_future(hpx::id_type());
+        LOG_DEBUG_MSG("requested wrapper from locality " << locality);
         //
         return hpx::lcos::local::dataflow(
                hpx::launch::sync,
-               hpx::util::unwrapped([&](hpx::id_type wrapper, hpx::id_type counter) -> int
+               hpx::util::unwrapped([=](hpx::id_type wrapper, hpx::id_type tabu_wrapper) -> int
         {
             solver_manager::solver_ptr wrappedSolver = spinsolver::scheduler.getSolver();
+            solver_manager::tabu_solver_ptr tabuSolver = spinsolver::scheduler.getTabuSolver();
             LOG_DEBUG_MSG("taking state_mutex : changing solver state data for locality " << locality);
             std::unique_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
-            set_solver_state_data(locality, {spinsolver::status::READY, wrapper, counter, spinsolver::os_threads, 0.0});
+            auto it = spinsolver::locality_states.find(locality);
+            std::string allocation = it!=spinsolver::locality_states.end() ? it->second.allocation : "";
+            set_solver_state_data(locality,
+                {spinsolver::status::READY, wrapper, spinsolver::os_threads, allocation, tabu_wrapper});
             wrappedSolver->addSolverId(wrapper);
+            if (tabuSolver && tabu_wrapper) tabuSolver->addSolverId(tabu_wrapper);
             LOG_DEBUG_MSG("releasing state_mutex (init_node)" << locality);
             return 1;
         }),
-        wrapper, counter);
+        wrapper, tabu_wrapper);
     });
 }
 
 //----------------------------------------------------------------------------
-// Test we can execute a shell command and get the result
-// ip route get 8.8.8.8 | awk 'NR==1 {print $NF}'
+// Initialize a batch of nodes : the Hamiltonian is sent (along a tree) only to
+// those that do not have it cached, then each node creates its wrapper
 //----------------------------------------------------------------------------
-void test_shell_command(const std::string &name, int rank)
+hpx::future<int> init_nodes(const std::vector<hpx::id_type> &localities)
 {
-    std::vector<std::string> command_list = {
-      "ip", "route", "get", "8.8.8.8", "|", "awk", "'NR==1 {print $NF}'"
-    };
-//    command_list.push_back("hostname");
-    std::vector<std::string> result = ExecuteAndCapture(command_list, 30.0, true);
-    for (auto & str_return : result) {
-        std::cout << "Locality " << name.c_str() << " with rank : " << rank << " : ";
-        std::cout << str_return.c_str() << std::endl;
+    hpx::future<void> distributed = spinsolver::instances::distribute(
+        spinsolver::hamiltonian, spinsolver::hamiltonian_hash, localities);
+    return distributed.then(
+        [localities](hpx::future<void> f) -> int
+    {
+        f.get();
+        std::vector<hpx::future<int>> initialized;
+        for (auto &l : localities) {
+            initialized.push_back(init_one_node(l));
+        }
+        hpx::wait_all(initialized);
+        return static_cast<int>(localities.size());
+    });
+}
+
+hpx::future<int> init_node(const hpx::id_type locality)
+{
+    return init_nodes(std::vector<hpx::id_type>(1, locality));
+}
+
+//----------------------------------------------------------------------------
+// Nodes added by a slurm job connect within a short time of each other, wait
+// a moment so that they are initialized as one batch (one broadcast tree)
+//----------------------------------------------------------------------------
+int connect_pending_nodes()
+{
+    hpx::this_thread::sleep_for(std::chrono::milliseconds(200));
+    // nodes may connect before rank 0 has loaded the input
+    hpx::shared_future<void> ready = spinsolver::input_ready;
+    ready.get();
+    std::vector<hpx::id_type> batch;
+    {
+        std::lock_guard<hpx::lcos::local::spinlock> lock(spinsolver::pending_mutex);
+        batch.swap(spinsolver::pending_nodes);
     }
-    //
-    result = ExecuteAndCaptureSSH(command_list, 30.0, "", "", "", "monch.cscs.ch", false);
-    for (auto & str_return : result) {
-        std::cout << "Locality " << name.c_str() << " using ssh : ";
-        std::cout << str_return.c_str() << std::endl;
+    std::cout << "Initializing " << batch.size() << " new localities" << std::endl;
+    return init_nodes(batch).get();
+}
+
+//----------------------------------------------------------------------------
+// The localities the telemetry service samples, those that are READY
+//----------------------------------------------------------------------------
+std::vector<hpx::id_type> ready_localities()
+{
+    std::vector<hpx::id_type> ready;
+    std::shared_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+    for (auto &l : spinsolver::locality_states) {
+        if (l.second.state==spinsolver::status::READY) {
+            ready.push_back(l.first);
+        }
+    }
+    return ready;
+}
+
+// and their solver wrappers, the workers of service jobs
+std::vector<hpx::id_type> ready_solver_wrappers()
+{
+    std::vector<hpx::id_type> wrappers;
+    std::shared_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+    for (auto &l : spinsolver::locality_states) {
+        if (l.second.state==spinsolver::status::READY) {
+            wrappers.push_back(l.second.solver_wrapper);
+        }
     }
+    return wrappers;
 }
 
 //----------------------------------------------------------------------------
-// A monitoring thread which queries the amount of work on a locality
-// Experimental for future use.
+// A drained locality leaves the runtime, the process exits and with it its
+// slurm job step
 //----------------------------------------------------------------------------
-void stop_monitor(std::shared_ptr<hpx::promise<void>> p)
+int disconnect_locality()
 {
-    // Set the future to terminate the monitor thread
-    p->set_value();
+    std::cout << "Locality " << spinsolver::name << " disconnecting" << std::endl;
+    // reply first, the runtime of this locality stops in disconnect
+    hpx::apply([]() { hpx::disconnect(); });
+    return 1;
 }
 
-int demo(int x)
+HPX_PLAIN_ACTION(disconnect_locality, disconnect_locality_action);
+
+//----------------------------------------------------------------------------
+// The allocation of drained localities is cancelled (on the provisioning I/O
+// thread) once all of its localities are disconnecting, the job of rank 0 is
+// never released
+//----------------------------------------------------------------------------
+int release_allocation(const std::string &allocation)
 {
-    std::cout << "Demo function " << x << std::endl;
+    {
+        std::unique_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+        // (failed localities are INVALID)
+        for (auto &l : spinsolver::locality_states) {
+            if (l.second.allocation==allocation &&
+                l.second.state!=spinsolver::status::DISCONNECTING &&
+                l.second.state!=spinsolver::status::INVALID) return 0;
+        }
+        for (auto it = spinsolver::locality_states.begin(); it!=spinsolver::locality_states.end(); ) {
+            if (it->second.allocation==allocation) it = spinsolver::locality_states.erase(it);
+            else ++it;
+        }
+    }
+    std::cout << "Releasing allocation " << allocation << std::endl;
+    spinsolver::batch.release(allocation);
     return 1;
 }
 
 //----------------------------------------------------------------------------
-// loops until terminated : Broken, does not terminate
-// gets the counter from all localities currently connected and ready
+// Every master issuing steps to a locality, with the wrapper it knows the
+// locality by : the masters of service jobs and the SA master of rank 0 use
+// its SA wrapper, the tabu master (portfolio) its tabu wrapper
 //----------------------------------------------------------------------------
-int monitor(double runfor, boost::uint64_t pause)
+typedef std::vector<std::pair<std::shared_ptr<solver_master>, hpx::id_type>> master_list;
+
+master_list masters_of(const spinsolver::locality_data &data)
+{
+    master_list masters;
+    for (auto &m : spinsolver::service.masters()) {
+        masters.push_back(std::make_pair(m, data.solver_wrapper));
+    }
+    masters.push_back(std::make_pair(spinsolver::scheduler.getSolver(), data.solver_wrapper));
+    if (spinsolver::scheduler.getTabuSolver() && data.tabu_wrapper) {
+        masters.push_back(std::make_pair(spinsolver::scheduler.getTabuSolver(), data.tabu_wrapper));
+    }
+    return masters;
+}
+
+std::vector<std::shared_ptr<solver_master>> all_masters()
 {
-    // timing
-    boost::int64_t zero_time = 0;
-    hpx::util::high_resolution_timer t;
+    std::vector<std::shared_ptr<solver_master>> masters;
+    for (auto &m : spinsolver::service.masters()) {
+        masters.push_back(m);
+    }
+    masters.push_back(spinsolver::scheduler.getSolver());
+    if (spinsolver::scheduler.getTabuSolver()) {
+        masters.push_back(spinsolver::scheduler.getTabuSolver());
+    }
+    return masters;
+}
 
-    // stop this thread when shutdown is initiated
-    std::shared_ptr<hpx::promise<void>> stop_flag = std::make_shared<hpx::promise<void>>();
-    hpx::future<void> f = stop_flag->get_future();
-    hpx::register_shutdown_function(hpx::util::bind(&stop_monitor, std::move(stop_flag)));
+//----------------------------------------------------------------------------
+// Scale down a locality : it is set to FINALIZING and every master (the
+// wrapper of rank 0 and those of running service jobs) stops issuing it new
+// repetitions and collects its steps in flight. Steps still running after
+// drain_timeout seconds are given up and their seeds issued on other nodes.
+// The locality then disconnects (DISCONNECTING) and its allocation is
+// released when it was the last one of it.
+//----------------------------------------------------------------------------
+int drain_locality(const hpx::id_type locality)
+{
+    master_list masters;
+    {
+        std::unique_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+        auto it = spinsolver::locality_states.find(locality);
+        if (locality==spinsolver::here || it==spinsolver::locality_states.end() ||
+            it->second.state!=spinsolver::status::READY) return 0;
+        it->second.state = spinsolver::status::FINALIZING;
+        masters = masters_of(it->second);
+    }
+    std::cout << "Draining locality " << hpx::naming::get_locality_id_from_id(locality) << std::endl;
+    //
+    for (auto &m : masters) {
+        m.first->drainSolverId(m.second);
+    }
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(static_cast<int64_t>(1000*spinsolver::drain_timeout));
+    while (true) {
+        int64_t in_flight = 0;
+        for (auto &m : masters) {
+            in_flight += m.first->inFlight(m.second);
+        }
+        if (in_flight==0) break;
+        if (std::chrono::steady_clock::now()>deadline) {
+            std::cout << "Drain timeout, " << in_flight << " steps will be issued again" << std::endl;
+            for (auto &m : masters) {
+                m.first->abandonSolverId(m.second);
+            }
+            break;
+        }
+        hpx::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+    for (auto &m : masters) {
+        m.first->removeSolverId(m.second);
+    }
+    //
+    std::string allocation;
+    {
+        std::unique_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+        auto it = spinsolver::locality_states.find(locality);
+        if (it!=spinsolver::locality_states.end()) {
+            it->second.state = spinsolver::status::DISCONNECTING;
+            allocation = it->second.allocation;
+        }
+    }
+    hpx::apply(disconnect_locality_action(), locality);
+    if (!allocation.empty()) {
+        release_allocation(allocation);
+    }
+    return 1;
+}
 
-    // numranks connectd
-    uint64_t initial_ranks = hpx::get_num_localities().get();
+//----------------------------------------------------------------------------
+// A locality that stopped answering heartbeats is INVALID : every master gives
+// up its steps in flight, whose seeds are issued again on the other
+// localities, and removes it. Its allocation is cancelled when no other
+// locality of it is left.
+//----------------------------------------------------------------------------
+int fail_locality(const hpx::id_type locality)
+{
+    master_list masters;
+    std::string allocation;
+    {
+        std::unique_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+        auto it = spinsolver::locality_states.find(locality);
+        if (locality==spinsolver::here || it==spinsolver::locality_states.end() ||
+            it->second.state==spinsolver::status::INVALID ||
+            it->second.state==spinsolver::status::DISCONNECTING) return 0;
+        it->second.state = spinsolver::status::INVALID;
+        masters = masters_of(it->second);
+        allocation = it->second.allocation;
+    }
+    std::cout << "Locality " << hpx::naming::get_locality_id_from_id(locality)
+              << " failed, issuing its repetitions again" << std::endl;
+    for (auto &m : masters) {
+        m.first->abandonSolverId(m.second);
+        m.first->removeSolverId(m.second);
+    }
+    if (!allocation.empty() && allocation!=spinsolver::allocation) {
+        release_allocation(allocation);
+    }
+    return 1;
+}
 
-    // output format object
-    boost::format formatter("Locality %s %12s, %s, %04d, %6.1f[s], %5.2f%%\n");
+// the localities that are sent heartbeats, those holding solve steps
+std::vector<hpx::id_type> solving_localities()
+{
+    std::vector<hpx::id_type> solving;
+    std::shared_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+    for (auto &l : spinsolver::locality_states) {
+        if (l.first!=spinsolver::here &&
+            (l.second.state==spinsolver::status::READY || l.second.state==spinsolver::status::FINALIZING)) {
+            solving.push_back(l.first);
+        }
+    }
+    return solving;
+}
 
-    while (runfor<0 || t.elapsed()<runfor)
+// seconds a heartbeat of the locality may take, 0 (no limit) until a step
+// time has been measured for it: the heartbeat waits behind its first
+// steps, which may take any time
+double heartbeat_timeout(const hpx::id_type &locality)
+{
+    master_list masters;
     {
-        // try to detect when hpx is shutting down
-        hpx::state run_state;
-        hpx::runtime* rt = hpx::get_runtime_ptr();
-        if (NULL == rt) {
-            // we're probably either starting or stopping
-            run_state = hpx::state_running;
+        std::shared_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+        auto it = spinsolver::locality_states.find(locality);
+        if (it!=spinsolver::locality_states.end() && it->second.solver_wrapper) {
+            masters = masters_of(it->second);
         }
-        else run_state = (rt->get_thread_manager().status());
- //       std::cout << "hpx runtime state is " << (int)run_state << std::endl;
+    }
+    double step = 0;
+    for (auto &m : masters) {
+        step = (std::max)(step, m.first->stepSeconds(m.second));
+    }
+    if (step<=0) return 0;
+    return (std::max)(spinsolver::heartbeat_timeout, spinsolver::heartbeat_factor*step);
+}
 
-        // stop collecting data when the runtime is exiting
-        // @TODO find out why quit does not work.
-        bool closing = hpx::threads::threadmanager_is(hpx::state_pre_shutdown);
-        if (closing) return 0;
-        if (f.is_ready()) return 0;
+//----------------------------------------------------------------------------
+// Drain up to N ready localities, the most recently added first. With
+// releasable set only localities that were added by their own slurm job
+// (not the one of rank 0) are chosen, draining others saves nothing.
+//----------------------------------------------------------------------------
+int drain_nodes(int N, bool releasable)
+{
+    std::vector<hpx::id_type> chosen;
+    {
+        std::shared_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+        auto root = spinsolver::locality_states.find(spinsolver::here);
+        std::string own = root!=spinsolver::locality_states.end() ? root->second.allocation : "";
+        for (auto it = spinsolver::locality_states.rbegin();
+             it!=spinsolver::locality_states.rend() && int(chosen.size())<N; ++it) {
+            if (it->first==spinsolver::here || it->second.state!=spinsolver::status::READY) continue;
+            if (releasable && (it->second.allocation.empty() || it->second.allocation==own)) continue;
+            chosen.push_back(it->first);
+        }
+    }
+    std::vector<hpx::future<int>> drained;
+    for (auto &l : chosen) {
+        drained.push_back(hpx::async(&drain_locality, l));
+    }
+    hpx::wait_all(drained);
+    return static_cast<int>(chosen.size());
+}
 
-        using namespace hpx::performance_counters;
-        using hpx::performance_counters::stubs::performance_counter;
-        std::vector< hpx::future<int> > future_counters;
-        std::vector< std::tuple<hpx::id_type, spinsolver::status, counter_value> > final_counters;
+//----------------------------------------------------------------------------
+// In service mode, give back the nodes of added allocations when no job has
+// been running for idle_seconds
+//----------------------------------------------------------------------------
+int drain_idle_nodes(double idle_seconds)
+{
+    while (hpx::is_running() && !spinsolver::service.active()) {
+        hpx::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    }
+    while (hpx::is_running() && spinsolver::service.active()) {
+        if (spinsolver::service.idle_seconds()>idle_seconds) {
+            int n = drain_nodes(std::numeric_limits<int>::max(), true);
+            if (n>0) std::cout << "Service idle, drained " << n << " localities" << std::endl;
+        }
+        hpx::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    }
+    return 0;
+}
 
-        //
-        // Query the performance counter for each connected locality.
-        //
-        {
-            LOG_DEBUG_MSG("Before looping over localities to get performance counters ");
-            std::shared_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
-            final_counters.resize(spinsolver::locality_states.size());
-            //
-            int index = 0;
-            for (auto l : spinsolver::locality_states) {
-                spinsolver::status state = l.second.state;
-                LOG_DEBUG_MSG("fetching info from locality " << l.first);
-                //
-                if (state!=spinsolver::status::READY) {
-                    final_counters[index] = std::make_tuple(l.first, state, counter_value(0));
-                    if (state==spinsolver::status::CONNECTING) {
-                        set_solver_state(l.first, spinsolver::status::INITIALIZING);
-                        hpx::apply(&init_node, l.first);
-                    }
-                }
-                else {
-                    if (l.second.idle_counter!=hpx::naming::invalid_id) {
-                        hpx::future<int> temp = performance_counter::get_value_async(l.second.idle_counter, true).then(
-                                hpx::launch::sync,
-                                [=,&final_counters](hpx::future<counter_value> val) -> hpx::future<int>
-                        {
-                            final_counters[index] = std::make_tuple(l.first, state, val.get());
-                            return hpx::make_ready_future<int>(1);
-                        });
-                        future_counters.push_back(std::move(temp));
-                    }
-                    else {
-                        throw std::runtime_error("Locality READY, but no counter");
-                    }
-                }
-                index++;
-            }
-            LOG_DEBUG_MSG("releasing state_mutex perf counter loop");
+//----------------------------------------------------------------------------
+// What the autoscaler sees : the progress summed over all masters, and the
+// localities of allocations added to the one of rank 0
+//----------------------------------------------------------------------------
+spinsolver::autoscale_input measure_progress()
+{
+    spinsolver::autoscale_input in;
+    for (auto &m : all_masters()) {
+        auto p = m->progress();
+        in.remaining += p.remaining;
+        in.unissued  += p.unissued;
+        in.rate      += p.rate;
+        // the masters share the localities
+        in.localities = (std::max)(in.localities, p.localities);
+    }
+    std::shared_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+    for (auto &l : spinsolver::locality_states) {
+        if (!l.second.allocation.empty() && l.second.allocation!=spinsolver::allocation &&
+            l.second.state!=spinsolver::status::DISCONNECTING) {
+            in.added++;
         }
-        //
-        LOG_DEBUG_MSG("before when_all (future_counter)");
-        when_all(future_counters).then(
-                hpx::launch::sync,
-                [&](hpx::future<std::vector< hpx::future<int>>> f)
-                {
-                LOG_DEBUG_MSG("after when_all (future_counter)");
-                for (auto c : final_counters) {
-                    hpx::id_type    &locality = std::get<0>(c);
-                    spinsolver::status &state = std::get<1>(c);
-                    counter_value      &value = std::get<2>(c);
-                    if (state==spinsolver::READY && status_is_valid(value.status_)) {
-                        if (!zero_time)
-                            zero_time = value.time_;
-
-                        std::cout << ( formatter
-                                % locality % state
-                                % " idle-rate"
-                                % value.count_
-                                % double((value.time_ - zero_time) * 1e-9)
-                                % (value.value_*0.01) );
-                    }
-                    else {
-                        std::cout << ( formatter
-                                % locality % state
-                                % "no-counter"
-                                % 0 % 0.0 % 0.0 );
-                    }
-                }
-                }
-        // add a get to the continuation so we can block until this is done
-        ).get();
-        // Schedule a suspend/wakeup after each check
-        hpx::this_thread::suspend(pause);
     }
-    // exit when thread is terminated or shutting down
+    return in;
+}
+
+int run_autoscaler(double interval)
+{
+    // requests that the batch system does not accept are not waited for
+    spinsolver::batch.on_failure([](const spinsolver::provisioning::allocation &a) {
+        spinsolver::autoscale.failed(a.name);
+    });
+    spinsolver::autoscale.run(&measure_progress,
+        [](int N, int minutes) { return spinsolver::batch.request(N, minutes); },
+        []() { return drain_nodes(std::numeric_limits<int>::max(), true); },
+        interval);
     return 0;
 }
 
+//----------------------------------------------------------------------------
+// The services rank 0 runs besides the solve, stopped before finalize
+//----------------------------------------------------------------------------
+void stop_services()
+{
+    spinsolver::telemetry.stop();
+    spinsolver::autoscale.stop();
+    spinsolver::heartbeats.stop();
+    spinsolver::batch.stop();
+}
+
 //----------------------------------------------------------------------------
 // Runs SA with many inputfiles
 // Args : beta0 is the starting temperature of SA (use 0.1 for bimodal instances)
@@ -453,62 +720,6 @@ int run_solvers()
     return 0;
 }
 
-//----------------------------------------------------------------------------
-// spawn instances of this program to demonstrate job resizing
-// this happens on the local node and is only for testing
-//----------------------------------------------------------------------------
-int add_nodes(int N)
-{
-    int agas_port = boost::lexical_cast<std::size_t>(hpx::get_config_entry("hpx.agas.port", 0));
-    std::vector<std::string> command_list;
-    command_list.push_back(APP_BINARY_NAME);
-    command_list.push_back("-Ihpx.parcel.port=" + std::to_string(agas_port));
-    command_list.push_back("--hpx:threads=2");
-    command_list.push_back("--hpx:connect");
-    ExecuteAndDetach(command_list, true);
-    return 0;
-}
-
-//----------------------------------------------------------------------------
-// execute slurm command to add nodes to running job
-// This is for productions use
-//----------------------------------------------------------------------------
-int add_nodes_slurm(int N, int hours, int mins,
-        const std::string &partition,
-        const std::string &account,
-        const std::string &reservation)
-{
-    static int num_jobs = 1;
-    std::string job_name = "spinsolve_" + boost::lexical_cast<std::string>(num_jobs++);
-    // script params
-    // "Usage : %1:Session name ($1)"
-    // "        %2:Hours needed ($2)"
-    // "        %3:Minutes needed ($3)"
-    // "        %4:server-num-nodes ($4)"
-    // "        %5:server-ip:port ($5)"
-    // "        %6:Partition ($6)"
-    // "        %7:Account ($7)"
-    // "        %8:reservation (${8})"
-
-    std::string script = std::string(SPINSOLVE_SOURCE_DIR) + "/scripts/" + std::string(SPINSOLVE_SCRIPT_NAME);
-    std::string my_ip = hpx::util::resolve_public_ip_address();
-    int agas_port = boost::lexical_cast<std::size_t>(hpx::get_config_entry("hpx.agas.port", 0));
-    //
-    std::vector<std::string> command_list;
-    command_list.push_back(script);
-    command_list.push_back(job_name.c_str());
-    command_list.push_back(std::to_string(hours));
-    command_list.push_back(std::to_string(mins));
-    command_list.push_back(std::to_string(N));
-    command_list.push_back(my_ip + ":" + std::to_string(agas_port));
-    command_list.push_back(partition);
-    command_list.push_back(account);
-    command_list.push_back(reservation);
-    std::vector<std::string> output = ExecuteAndCapture(command_list, 0.0, true);
-//    std::cout << output.c_str();
-    return 0;
-}
-
 //----------------------------------------------------------------------------
 // utility function to avoid blocking on cin getline
 //----------------------------------------------------------------------------
@@ -553,10 +764,11 @@ int poll_stdin()
                 if (cmd[0] == "reset") {
                 }
                 else if (cmd[0] == "ladd") {
+                    // localities on this node, for testing
                     if (cmd.size() == 2) {
                         int N = boost::lexical_cast<int>(cmd[1]);
                         if (N>0) {
-                            add_nodes(N);
+                            spinsolver::batch.request(N, 10, "local");
                         }
                     }
                 }
@@ -564,19 +776,41 @@ int poll_stdin()
                     if (cmd.size() == 2) {
                         int N = boost::lexical_cast<int>(cmd[1]);
                         if (N>0) {
-                            add_nodes_slurm(N, 0, 10,
-                                    spinsolver::partition, spinsolver::account, spinsolver::reservation);
+                            spinsolver::batch.request(N, 10);
+                        }
+                    }
+                }
+                else if (cmd[0] == "drain" || cmd[0] == "d") {
+                    if (cmd.size() == 2) {
+                        int N = boost::lexical_cast<int>(cmd[1]);
+                        if (N>0) {
+                            hpx::apply(&drain_nodes, N, false);
                         }
                     }
                 }
                 else if (cmd[0] == "query") {
-                    // not yet implemented
+                    std::shared_lock<hpx::lcos::local::shared_mutex> lock(spinsolver::state_mutex);
+                    for (auto &l : spinsolver::locality_states) {
+                        std::cout << "Locality " << hpx::naming::get_locality_id_from_id(l.first)
+                                  << " " << l.second.state;
+                        if (!l.second.allocation.empty()) {
+                            std::cout << " job " << l.second.allocation;
+                        }
+                        std::cout << std::endl;
+                    }
+                    for (auto &a : spinsolver::batch.allocations()) {
+                        std::cout << "Allocation " << a.name << " job " << a.job << " " << a.nodes
+                                  << " nodes " << a.minutes << " minutes, "
+                                  << spinsolver::provisioning::to_string(a.state)
+                                  << ", " << a.connected << " connected" << std::endl;
+                    }
                 }
                 else if (cmd[0] == "help") {
-                    std::cout << "commands are add(a) <n>, query, reset, quit(q) " << std::endl;
+                    std::cout << "commands are add(a) <n>, ladd <n>, drain(d) <n>, query, reset, quit(q) " << std::endl;
                 }
                 else if (cmd[0] == "quit" || cmd[0] == "q") {
                     spinsolver::scheduler.abort();
+                    spinsolver::service.stop();
                     abort = true;
                     break;
                 }
@@ -610,14 +844,26 @@ int hpx_main(boost::program_options::variables_map& vm)
     int port = boost::lexical_cast<std::size_t>(hpx::get_config_entry("hpx.parcel.port", 0));
     int agas = boost::lexical_cast<std::size_t>(hpx::get_config_entry("hpx.agas.port", 0));
     std::cout <<"Locality " << name.c_str() << " Rank " << rank << " Using port number " << port << " and agas " << agas << std::endl;
+    std::cout << "Locality " << name.c_str() << " Rank " << rank << " " << os_threads << " threads, "
+              << spinsolver::numa::domains().describe()
+              << ", binding " << hpx::get_config_entry("hpx.bind", "default")
+              << ", numa-sensitive " << hpx::get_config_entry("hpx.numa_sensitive", "0") << std::endl;
 
-    test_shell_command(name, rank);
+    // every locality looks for instances in the shared cache directory
+    spinsolver::instances::set_directory(vm["instance-cache"].as<std::string>());
+    spinsolver::instances::set_capacity(vm["instance-cache-size"].as<std::size_t>());
+
+    const char *job = std::getenv("SPINSOLVE_ALLOCATION");
+    if (!job) job = std::getenv("SLURM_JOB_ID");
+    const std::string allocation = job ? job : "";
+    spinsolver::allocation = allocation;
+    spinsolver::drain_timeout = vm["drain-timeout"].as<double>();
 
     if (rank!=0) {
         // although we should be connected to the console node, we send
         // a status update to signal that we're now ready to be used.
         // when it receives the state CONNECTING, it will update its copy of our state to READY
-        hpx::async(add_solver_state_action(), console, here, spinsolver::status::CONNECTING).get();
+        hpx::async(add_solver_state_action(), console, here, spinsolver::status::CONNECTING, allocation).get();
         std::cout << "Locality " << here << " Notified console " << std::endl;
 
         // all the slave nodes need to do is wait for work requests to come in
@@ -627,7 +873,7 @@ int hpx_main(boost::program_options::variables_map& vm)
         return 0;
     }
     else {
-        set_solver_state(here, spinsolver::status::READY);
+        set_solver_state(here, spinsolver::status::READY, allocation);
     }
 
     //
@@ -636,10 +882,29 @@ int hpx_main(boost::program_options::variables_map& vm)
     const std::string infile  = vm["input"].as<std::string>();
     const std::string outfile = vm["output"].as<std::string>();
     const uint64_t Ns         = vm["Ns"].as<uint64_t>();
-    const double beta0        = vm["beta0"].as<double>();
+    const std::string warm_file = vm["warm-start"].as<std::string>();
+    // warm started runs begin at an intermediate temperature
+    const double beta0        = warm_file.empty() ? vm["beta0"].as<double>() : vm["warm-beta"].as<double>();
     const double beta1        = vm["beta1"].as<double>();
     const uint64_t num_rep    = vm["repetitions"].as<uint64_t>();
     const double complexity   = vm["complexity"].as<double>();
+    const spin_format format  = parse_spin_format(vm["spin-format"].as<std::string>());
+    const std::string checkpoint_file = vm["checkpoint"].as<std::string>();
+    const double checkpoint_interval  = vm["checkpoint-interval"].as<double>();
+    const bool resume         = vm.count("resume")>0;
+    const std::string service_dir = vm["service"].as<std::string>();
+    //
+    spinsolver::solver_options.sa.nfold_acceptance = vm["nfold-acceptance"].as<double>();
+    spinsolver::solver_options.sa.freeze_sweeps    = vm["freeze-sweeps"].as<std::size_t>();
+    spinsolver::solver_options.sa.polish = parse_polish_mode(vm["polish"].as<std::string>());
+    spinsolver::solver_options.tabu.tenure       = vm["tabu-tenure"].as<std::size_t>();
+    spinsolver::solver_options.tabu.stall_sweeps = vm["tabu-stall"].as<std::size_t>();
+    std::vector<std::string> engines;
+    boost::split(engines, vm["engines"].as<std::string>(), boost::is_any_of(","), boost::token_compress_on);
+    for (auto &e : engines) {
+        if (e=="tabu") spinsolver::solver_options.with_tabu = true;
+    }
+    const bool race = engines.size()!=1 || engines[0]!="sa";
     //
     spinsolver::partition   = vm["partition"].as<std::string>();
     spinsolver::account     = vm["account"].as<std::string>();
@@ -652,12 +917,41 @@ int hpx_main(boost::program_options::variables_map& vm)
         }
         return hpx::finalize();
     }
+    for (auto &e : engines) {
+        if (e!="sa" && e!="tabu") {
+            std::cout << "error: unknown engine '" << e << "', use sa and/or tabu" << std::endl;
+            return hpx::finalize();
+        }
+    }
 
     //
-    // Load the hamiltonian
-    // @todo, add support for multiple solvers with their own H
+    // Load the hamiltonian, it is the default instance (0) of the solver wrappers,
+    // service jobs register further instances with them
     //
-    spinsolver::hamiltonian = std::make_shared<hamiltonian_type>(infile);
+    spinsolver::hamiltonian_hash = spinsolver::instances::store(
+        std::make_shared<const hamiltonian_type>(infile));
+    spinsolver::hamiltonian = spinsolver::instances::get(spinsolver::hamiltonian_hash);
+    spinsolver::instances::pin(spinsolver::hamiltonian_hash);
+
+    // the states of an earlier output file, the lowest ones are sent to
+    // every locality with the solver config
+    if (!warm_file.empty()) {
+        try {
+            std::ifstream warm_in(warm_file);
+            if (!warm_in) throw std::runtime_error("cannot open " + warm_file);
+            spinsolver::solver_options.warm = make_warm_start(
+                read_results(warm_in, *spinsolver::hamiltonian, format),
+                vm["warm-top"].as<std::size_t>(), vm["warm-randomise"].as<double>());
+        }
+        catch (std::exception &e) {
+            std::cout << "error: warm start " << warm_file << " : " << e.what() << std::endl;
+            return hpx::finalize();
+        }
+        std::cout << "Warm start from " << spinsolver::solver_options.warm.states.size()
+                  << " states of " << warm_file << " at beta0 " << beta0 << std::endl;
+    }
+
+    spinsolver::input_loaded.set_value();
 
     // for each locality, trigger the initialize_solver action so that all ranks are initialized
     // and ready to receive work. For now we pass the Hamiltonian as a parameter, but
@@ -666,39 +960,42 @@ int hpx_main(boost::program_options::variables_map& vm)
     fut.get();
 
 
-    hpx::threads::executors::local_priority_queue_os_executor exec;
-
-    // instead of executing a normal async call using
-    //   hpx::async(monitor, -1, 1000);
-    // we will manually create a high-priority thread to poll the performance counters
-    // we do this so that we get as much info as possible, but it still can be made to wait
-    // until a free work queue is available.
-    // @TODO This will be moved into a custom scheduler once it is ready.
-    hpx::apply(exec, &monitor, -1, 1000);
-/*
-    hpx::error_code ec(hpx::lightweight);
-    hpx::applier::register_thread_nullary(
-            hpx::util::bind(&monitor, -1, 1000),
-            "monitor",
-            hpx::threads::pending, true, hpx::threads::thread_priority_critical,
-            -1, hpx::threads::thread_stacksize_default, ec);
-*/
-    //
-    LOG_DEBUG_MSG("About to instantiate custom scheduler");
-    std::cout << "About to create custom schedluer"<<std::endl;
-
-    hpx::apply(exec, &demo, 42);
+    // sample the idle-rate and solver counters of all ready localities,
+    // to the console or to the telemetry file
+    spinsolver::telemetry.start(&ready_localities,
+        vm["telemetry-interval"].as<uint64_t>(),
+        vm["telemetry-samples"].as<uint64_t>(),
+        vm["telemetry-file"].as<std::string>());
+
+    // node requests go to slurm (or to processes on this node with
+    // --scheduler=local) from the provisioning I/O thread
+    const int agas_port = boost::lexical_cast<int>(hpx::get_config_entry("hpx.agas.port", 0));
+    const std::string scheduler = vm["scheduler"].as<std::string>();
+    spinsolver::batch.add_backend("slurm",
+        std::make_shared<spinsolver::provisioning::slurm_backend>(
+            std::string(SPINSOLVE_SOURCE_DIR) + "/scripts/" + std::string(SPINSOLVE_SCRIPT_NAME),
+            agas_port, spinsolver::partition, spinsolver::account, spinsolver::reservation),
+        scheduler=="slurm");
+    spinsolver::batch.add_backend("local",
+        std::make_shared<spinsolver::provisioning::local_backend>(APP_BINARY_NAME, agas_port, 2),
+        scheduler=="local");
+    spinsolver::batch.start(vm["provision-poll"].as<double>());
+
+    // localities that stop answering are removed and their repetitions issued again
+    if (vm["heartbeat-interval"].as<double>()>0) {
+        spinsolver::heartbeat_timeout = vm["heartbeat-timeout"].as<double>();
+        spinsolver::heartbeats.start(&solving_localities, &heartbeat_timeout,
+            [](const hpx::id_type &l) { fail_locality(l); },
+            static_cast<uint64_t>(1000*vm["heartbeat-interval"].as<double>()),
+            vm["heartbeat-misses"].as<int>());
+    }
 
-/*
-    custom_scheduler my_scheduler;
-    my_scheduler.register_thread_nullary(
-            hpx::util::bind(&demo, 42),
-            "demo",
-            hpx::threads::pending, true, hpx::threads::thread_priority_critical,
-            -1, hpx::threads::thread_stacksize_default, ec);
-
-    std::cout << "created custom schedluer"<<std::endl;
-*/
+    // request and give back allocations to meet the deadline or budget
+    if (vm.count("autoscale")) {
+        spinsolver::autoscale.configure(60*vm["deadline"].as<double>(), vm["budget"].as<double>(),
+            vm["autoscale-startup"].as<double>(), vm["autoscale-max-nodes"].as<std::size_t>());
+        hpx::apply(&run_autoscaler, vm["autoscale-interval"].as<double>());
+    }
 
     //
     // create a fire and forget poll stdin thread for input commands
@@ -707,6 +1004,21 @@ int hpx_main(boost::program_options::variables_map& vm)
     //
     hpx::apply(poll_stdin);
 
+    //
+    // in service mode rank 0 runs the jobs of the queue directory until it is
+    // told to stop, instead of the single run given on the command line
+    //
+    if (!service_dir.empty()) {
+        const double drain_idle = vm["drain-idle"].as<double>();
+        if (drain_idle>0) {
+            hpx::apply(&drain_idle_nodes, drain_idle);
+        }
+        spinsolver::service.run(service_dir, &ready_solver_wrappers,
+            vm["service-jobs"].as<std::size_t>(), vm["service-poll"].as<uint64_t>());
+        stop_services();
+        return hpx::finalize();
+    }
+
     // every node has registered its own copy of the solver manager, we need the Ids on each node
     // so that we can invoke remote calls on them
     std::vector<hpx::future<hpx::id_type>> _SolverIdForRank;
@@ -729,6 +1041,7 @@ int hpx_main(boost::program_options::variables_map& vm)
     + " beta0=" + std::to_string(beta0)
     + " beta1=" + std::to_string(beta1)
     + " num_rep=" + std::to_string(num_rep)
+    + " spin_format=" + to_string(format)
     << std::endl;
 
     //
@@ -738,6 +1051,59 @@ int hpx_main(boost::program_options::variables_map& vm)
     SolverIdForRank.clear();
     wrappedSolver->setSolverIds(SolverIdForRank);
 
+    //
+    // Checkpointing : when resuming, the completed repetitions are read back
+    // and rewritten as the first record of a new checkpoint, their seeds are skipped
+    //
+    if (race && !checkpoint_file.empty()) {
+        std::cout << "error: --checkpoint is only supported with --engines=sa" << std::endl;
+        stop_services();
+        return hpx::finalize();
+    }
+    if (resume && checkpoint_file.empty()) {
+        std::cout << "error: --resume needs a --checkpoint file" << std::endl;
+        stop_services();
+        return hpx::finalize();
+    }
+    if (!resume && !checkpoint_file.empty() && std::ifstream(checkpoint_file)) {
+        // a forgotten --resume must not replace the checkpoint of a long run
+        std::cout << "error: checkpoint " << checkpoint_file
+                  << " exists, add --resume to continue it or remove it" << std::endl;
+        stop_services();
+        return hpx::finalize();
+    }
+    if (!checkpoint_file.empty()) {
+        checkpoint_header header(*spinsolver::hamiltonian, num_rep, Ns, beta0, beta1);
+        checkpoint_state restored;
+        std::shared_ptr<checkpoint_writer> writer;
+        // a missing, corrupt or unwritable checkpoint ends the run like a bad argument
+        try {
+            if (resume) {
+                restored = read_checkpoint(checkpoint_file);
+                if (restored.header!=header) {
+                    throw std::runtime_error("written for a different input or parameters");
+                }
+            }
+            writer = std::make_shared<checkpoint_writer>(checkpoint_file, header,
+                restored.results, restored.next_seed, restored.elapsed);
+        }
+        catch (std::exception &e) {
+            std::cout << "error: checkpoint " << checkpoint_file << " : " << e.what() << std::endl;
+            stop_services();
+            return hpx::finalize();
+        }
+        if (resume) {
+            std::cout << "Resuming from " << checkpoint_file << " : " << restored.results.size()
+                      << " repetitions completed, seeds";
+            for (auto &r : restored.completed_ranges()) {
+                std::cout << " " << r.first << "-" << r.second;
+            }
+            std::cout << std::endl;
+            wrappedSolver->setCompleted(restored.results, restored.elapsed);
+        }
+        wrappedSolver->setCheckpoint(writer, checkpoint_interval);
+    }
+
     // start timer
     std::chrono::time_point<std::chrono::system_clock> start_calc, end_calc, start_io, end_io;
     start_calc = std::chrono::system_clock::now();
@@ -745,9 +1111,28 @@ int hpx_main(boost::program_options::variables_map& vm)
     // on locality 0 we will act as master and execute the solver via the wrapper
     // ranks will receive requests for solve operations from master process
     solver_manager::result_type x;
-    if (rank==0) {
+    if (rank==0 && !race) {
         x = wrappedSolver->spawn(num_rep, beta0, beta1, Ns);
     }
+    else if (rank==0) {
+        // race the engines on all localities, each runs num_rep repetitions
+        // unless the portfolio cancels them first
+        spinsolver::portfolio engine_race(
+            vm.count("target") ? vm["target"].as<double>() : -std::numeric_limits<double>::infinity(),
+            vm["portfolio-patience"].as<double>(), vm["portfolio-interval"].as<double>());
+        solver_manager::tabu_solver_ptr tabuSolver = spinsolver::scheduler.getTabuSolver();
+        for (auto &e : engines) {
+            if (e=="sa") {
+                engine_race.add(e, wrappedSolver,
+                    [=]() { return wrappedSolver->spawn(num_rep, beta0, beta1, Ns); });
+            }
+            else {
+                engine_race.add(e, tabuSolver,
+                    [=]() { return tabuSolver->spawn(num_rep, beta0, beta1, Ns); });
+            }
+        }
+        x = engine_race.run();
+    }
 
     // stop timer
     end_calc = std::chrono::system_clock::now();
@@ -759,12 +1144,23 @@ int hpx_main(boost::program_options::variables_map& vm)
             << ", threads, "          << os_threads 
             << ", Calculation_time, " << elapsed_seconds.count() << std::endl;
 
+    // solver statistics summed over all repetitions, per locality lines were
+    // printed by the wrapper
+    solver_stats total_stats;
+    for (auto &r : x) {
+        total_stats += r.stats_;
+    }
+    std::cout << "CSVStats , total, " << total_stats << std::endl;
+
     // start timer
     start_io = std::chrono::system_clock::now();
 
-    // Write out vector to file
+    // Write out vector to file, remapping spins to the input labels if requested
     // @TODO, make each task write out it's own results or collect?
-    std::copy(x.begin(), x.end(), std::ostream_iterator<sa_solver::result_type>(out));
+    result_writer writer(*spinsolver::hamiltonian, format);
+    for (auto &r : x) {
+        writer(out, r);
+    }
     out.close();
 
     // stop timer
@@ -772,6 +1168,7 @@ int hpx_main(boost::program_options::variables_map& vm)
     elapsed_seconds = end_io-start_io;
     std::cout << "IO time: " << elapsed_seconds.count() << "s\n";
 
+    stop_services();
     return hpx::finalize();
 }
 
@@ -832,6 +1229,180 @@ int main(int argc, char* argv[])
                             "A logarithmic estimate of the computational requirements of a single solve step\n"
                             "This figure is used as a helper to decide how to split up repetitions/iterations between threads\n"
                     );
+    spinsolver::desc.add_options()
+                    ("spin-format",
+                            boost::program_options::value<std::string>()->default_value("internal"),
+                            "How spins are written to the output file\n"
+                            "internal : one digit per spin in solver order\n"
+                            "labels   : one digit per spin in order of the input file site labels\n"
+                            "pairs    : label:spin pairs in order of the input file site labels\n"
+                    );
+    spinsolver::desc.add_options()
+                    ("checkpoint",
+                            boost::program_options::value<std::string>()->default_value(""),
+                            "Write completed repetitions to this binary checkpoint file during the run");
+    spinsolver::desc.add_options()
+                    ("checkpoint-interval",
+                            boost::program_options::value<double>()->default_value(60.0),
+                            "Seconds between two checkpoint writes");
+    spinsolver::desc.add_options()
+                    ("resume",
+                            "Continue the run stored in the --checkpoint file, skipping its completed seeds");
+    spinsolver::desc.add_options()
+                    ("service",
+                            boost::program_options::value<std::string>()->default_value(""),
+                            "Run as a solver service on this queue directory: every <id>.job file\n"
+                            "(key=value lines: input, output, Ns, repetitions, beta0, beta1,\n"
+                            "priority, spin-format) is solved and its results written to done/<id>.out.\n"
+                            "Create the file 'stop' in the directory (or type quit) to shut down");
+    spinsolver::desc.add_options()
+                    ("service-jobs",
+                            boost::program_options::value<std::size_t>()->default_value(2),
+                            "Number of service jobs that run at the same time");
+    spinsolver::desc.add_options()
+                    ("service-poll",
+                            boost::program_options::value<uint64_t>()->default_value(1000),
+                            "Milliseconds between two scans of the service queue directory");
+    spinsolver::desc.add_options()
+                    ("drain-timeout",
+                            boost::program_options::value<double>()->default_value(60.0),
+                            "Seconds a drained locality may take to finish its repetitions in flight,\n"
+                            "after that they are issued again on the remaining localities");
+    spinsolver::desc.add_options()
+                    ("drain-idle",
+                            boost::program_options::value<double>()->default_value(0.0),
+                            "In service mode, drain the localities of added slurm allocations and\n"
+                            "release them after this many seconds without a running job (0 = never)");
+    spinsolver::desc.add_options()
+                    ("heartbeat-interval",
+                            boost::program_options::value<double>()->default_value(5.0),
+                            "Seconds between two heartbeats rank 0 sends to each solving locality (0 = off)");
+    spinsolver::desc.add_options()
+                    ("heartbeat-timeout",
+                            boost::program_options::value<double>()->default_value(10.0),
+                            "Least seconds a heartbeat may take, the limit grows with the measured\n"
+                            "time of a solve step on the locality; no limit before a step has been timed");
+    spinsolver::desc.add_options()
+                    ("heartbeat-misses",
+                            boost::program_options::value<int>()->default_value(3),
+                            "Missed heartbeats in a row after which a locality counts as failed\n"
+                            "and its repetitions are issued again elsewhere");
+    spinsolver::desc.add_options()
+                    ("polish",
+                            boost::program_options::value<std::string>()->default_value("none"),
+                            "Local search on every result after the anneal : none, descent (steepest\n"
+                            "descent to a local minimum) or pairs (also flips of two coupled spins)");
+    spinsolver::desc.add_options()
+                    ("nfold-acceptance",
+                            boost::program_options::value<double>()->default_value(0.02),
+                            "Acceptance below which the rest of an anneal runs rejection free\n"
+                            "(n-fold way, integer couplings only, 0 = never)");
+    spinsolver::desc.add_options()
+                    ("freeze-sweeps",
+                            boost::program_options::value<std::size_t>()->default_value(100),
+                            "Sweeps without progress after which an anneal counts as frozen and ends\n"
+                            "with a greedy descent (0 = always run all Ns sweeps)");
+    spinsolver::desc.add_options()
+                    ("warm-start",
+                            boost::program_options::value<std::string>()->default_value(""),
+                            "Start the runs from the configurations of this output file (of the same\n"
+                            "input, in its spin format) instead of random spins");
+    spinsolver::desc.add_options()
+                    ("warm-top",
+                            boost::program_options::value<std::size_t>()->default_value(16),
+                            "Number of lowest distinct configurations of the --warm-start file used (0 = all)");
+    spinsolver::desc.add_options()
+                    ("warm-beta",
+                            boost::program_options::value<double>()->default_value(1.0),
+                            "Inverse temperature warm started runs begin at (replaces --beta0)");
+    spinsolver::desc.add_options()
+                    ("warm-randomise",
+                            boost::program_options::value<double>()->default_value(0.0),
+                            "Fraction of the spins of a warm start configuration flipped before a run");
+    spinsolver::desc.add_options()
+                    ("engines",
+                            boost::program_options::value<std::string>()->default_value("sa"),
+                            "Solver engines, comma separated (sa, tabu). With more than one they race on\n"
+                            "all localities as a portfolio, cores shift to the engine with the best\n"
+                            "energy (not in --service mode)");
+    spinsolver::desc.add_options()
+                    ("target",
+                            boost::program_options::value<double>(),
+                            "Energy at which the portfolio cancels all engines");
+    spinsolver::desc.add_options()
+                    ("portfolio-patience",
+                            boost::program_options::value<double>()->default_value(120.0),
+                            "Seconds without a better energy after which the portfolio cancels all\n"
+                            "engines (0 = run all repetitions)");
+    spinsolver::desc.add_options()
+                    ("portfolio-interval",
+                            boost::program_options::value<double>()->default_value(5.0),
+                            "Seconds between two share updates of the portfolio");
+    spinsolver::desc.add_options()
+                    ("tabu-tenure",
+                            boost::program_options::value<std::size_t>()->default_value(0),
+                            "Iterations a flipped spin is tabu (0 = min(20, N/4)+1)");
+    spinsolver::desc.add_options()
+                    ("tabu-stall",
+                            boost::program_options::value<std::size_t>()->default_value(10),
+                            "Sweeps without a new best after which tabu search restarts (0 = never)");
+    spinsolver::desc.add_options()
+                    ("scheduler",
+                            boost::program_options::value<std::string>()->default_value("slurm"),
+                            "Where added nodes are requested : slurm, or local to start the\n"
+                            "localities as processes of this node (for testing)");
+    spinsolver::desc.add_options()
+                    ("provision-poll",
+                            boost::program_options::value<double>()->default_value(30.0),
+                            "Seconds between two queries of the batch system for the state of\n"
+                            "the requested allocations");
+    spinsolver::desc.add_options()
+                    ("autoscale",
+                            "Add slurm allocations when the measured throughput would miss the --deadline\n"
+                            "(or, without one, as far as the --budget pays) and drain them at the end");
+    spinsolver::desc.add_options()
+                    ("deadline",
+                            boost::program_options::value<double>()->default_value(0.0),
+                            "Minutes from the start by which the run should finish (0 = none)");
+    spinsolver::desc.add_options()
+                    ("budget",
+                            boost::program_options::value<double>()->default_value(0.0),
+                            "Node-hours the autoscaler may request in total (0 = no limit, only the --deadline counts)");
+    spinsolver::desc.add_options()
+                    ("autoscale-max-nodes",
+                            boost::program_options::value<std::size_t>()->default_value(16),
+                            "Most localities the autoscaler adds");
+    spinsolver::desc.add_options()
+                    ("autoscale-startup",
+                            boost::program_options::value<double>()->default_value(180.0),
+                            "Initial estimate of the seconds from a node request until it solves,\n"
+                            "updated from the nodes that connect");
+    spinsolver::desc.add_options()
+                    ("autoscale-interval",
+                            boost::program_options::value<double>()->default_value(30.0),
+                            "Seconds between two autoscaling decisions");
+    spinsolver::desc.add_options()
+                    ("instance-cache",
+                            boost::program_options::value<std::string>()->default_value(""),
+                            "Directory on a shared filesystem where localities cache Hamiltonians\n"
+                            "by content hash, instances found there are not sent over the network");
+    spinsolver::desc.add_options()
+                    ("instance-cache-size",
+                            boost::program_options::value<std::size_t>()->default_value(8),
+                            "Number of Hamiltonians no job uses that each locality keeps in memory");
+    spinsolver::desc.add_options()
+                    ("telemetry-file",
+                            boost::program_options::value<std::string>()->default_value(""),
+                            "Write the sampled counters of every locality to this CSV file\n"
+                            "instead of printing them to the console");
+    spinsolver::desc.add_options()
+                    ("telemetry-interval",
+                            boost::program_options::value<uint64_t>()->default_value(1000),
+                            "Milliseconds between two samples of the locality counters");
+    spinsolver::desc.add_options()
+                    ("telemetry-samples",
+                            boost::program_options::value<uint64_t>()->default_value(3600),
+                            "Number of samples kept in memory per locality");
 
     // Initialize and run HPX,
     // we want to run hpx_main on all all localities so that each can initialize
@@ -839,6 +1410,10 @@ int main(int argc, char* argv[])
     // This command line option is added to tell hpx to run hpx_main on all localities and not just rank 0
     std::vector<std::string> cfg;
     cfg.push_back("hpx.run_hpx_main!=1");
+
+    // the solver statistics counters must exist on every locality
+    hpx::register_startup_function(&spinsolver::counters::register_counter_types);
+
     return hpx::init(spinsolver::desc, argc, argv, cfg);
 }
 
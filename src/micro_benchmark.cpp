@@ -0,0 +1,392 @@
+//----------------------------------------------------------------------------
+// Micro benchmarks of the SA kernel and the Hamiltonian loader.
+// Does not need HPX, so it can be built and run on any development machine.
+//
+// example command line
+//   spinsolve_bench --json bench.json --min-time 1.0 --Ns 100,1000 extra.lat
+// Measures, for the testdata instance, a few synthetic square lattices and any
+// .lat files given on the command line :
+//   sa_solver::run        spin flip attempts per second for each Ns
+//   tabu_solver::run      iterations per second for each Ns
+//   delta_energy          evaluations per second (reference implementation)
+//   compute_energy        evaluations per second (reference implementation)
+//   hamiltonian parse     MB/s and terms/s
+// Results are printed and written as JSON together with CPU and compiler info
+// so that builds can be compared against each other.
+//----------------------------------------------------------------------------
+
+// STL includes
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <stdexcept>
+#include <cstdint>
+
+// Solver related includes
+#include "hamiltonian.hpp"
+#include "result.hpp"
+#include "sa_solver.hpp"
+#include "tabu_solver.hpp"
+
+#ifndef SPINSOLVE_BENCH_FLAGS
+#define SPINSOLVE_BENCH_FLAGS ""
+#endif
+
+//----------------------------------------------------------------------------
+// access to the private energy functions of the solver
+//----------------------------------------------------------------------------
+class sa_solver_benchmark
+{
+public:
+  static void set_spins(sa_solver& solver, const std::vector<int>& spins) {
+    solver.spins_ = spins;
+  }
+  static double compute_energy(const sa_solver& solver) {
+    return solver.compute_energy();
+  }
+  static double delta_energy(const sa_solver& solver, unsigned i) {
+    return solver.delta_energy(i);
+  }
+};
+
+//----------------------------------------------------------------------------
+// one measurement, becomes one entry of the JSON results array
+//----------------------------------------------------------------------------
+struct measurement
+{
+  std::string name;
+  std::string instance;
+  std::string kernel;
+  std::size_t N;
+  std::size_t Ns;
+  std::size_t iterations;
+  double      seconds;
+  double      rate;
+  std::string unit;
+};
+
+struct instance
+{
+  std::string name;
+  std::string text;   // the .lat file contents
+  std::size_t terms;
+};
+
+typedef std::chrono::steady_clock clock_type;
+
+double seconds_since(const clock_type::time_point& t0)
+{
+  return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+//----------------------------------------------------------------------------
+// run f() repeatedly (doubling the batch) until at least min_time has passed
+// returns the number of calls and the elapsed time
+//----------------------------------------------------------------------------
+template <typename F>
+std::pair<std::size_t,double> time_loop(F f, double min_time)
+{
+  std::size_t calls(0), batch(1);
+  const clock_type::time_point t0 = clock_type::now();
+  double elapsed(0.0);
+  do {
+    for (std::size_t b=0; b<batch; ++b) f();
+    calls += batch;
+    batch *= 2;
+    elapsed = seconds_since(t0);
+  } while (elapsed < min_time);
+  return std::make_pair(calls, elapsed);
+}
+
+//----------------------------------------------------------------------------
+// random +-1 square lattice with periodic boundaries, in .lat format
+//----------------------------------------------------------------------------
+instance square_lattice(unsigned L, unsigned seed)
+{
+  std::minstd_rand0 gen(seed);
+  std::uniform_int_distribution<int> sign(0, 1);
+  std::ostringstream os;
+  os << "# square lattice " << L << "x" << L << " periodic, random +-1 couplings\n";
+  for (unsigned y=0; y<L; ++y) {
+    for (unsigned x=0; x<L; ++x) {
+      const unsigned i = y*L + x + 1;
+      os << i << " " << (y*L + (x+1)%L + 1) << " " << (sign(gen) ? 1 : -1) << "\n";
+      os << i << " " << (((y+1)%L)*L + x + 1) << " " << (sign(gen) ? 1 : -1) << "\n";
+    }
+  }
+  return {"square" + std::to_string(L) + "x" + std::to_string(L), os.str(), 2*L*L};
+}
+
+instance read_instance(const std::string& file_name)
+{
+  std::ifstream in(file_name);
+  if (!in) throw std::runtime_error("cannot open " + file_name);
+  std::ostringstream os;
+  os << in.rdbuf();
+  instance inst{file_name.substr(file_name.find_last_of("/\\") + 1), os.str(), 0};
+  std::istringstream lines(inst.text);
+  std::string line;
+  while (std::getline(lines, line))
+    if (line.find(' ') != std::string::npos && line.find('#') == std::string::npos)
+      ++inst.terms;
+  return inst;
+}
+
+//----------------------------------------------------------------------------
+// machine description for the JSON header
+//----------------------------------------------------------------------------
+std::string cpu_model()
+{
+  std::ifstream in("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      const std::size_t pos = line.find(':');
+      if (pos != std::string::npos)
+        return line.substr(line.find_first_not_of(' ', pos+1));
+    }
+  }
+  return "unknown";
+}
+
+std::string compiler_name()
+{
+#if defined(__clang__)
+  return "clang " __clang_version__;
+#elif defined(__INTEL_COMPILER)
+  return "intel " + std::to_string(__INTEL_COMPILER);
+#elif defined(__GNUC__)
+  return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+  return "msvc " + std::to_string(_MSC_FULL_VER);
+#else
+  return "unknown";
+#endif
+}
+
+std::string json_string(const std::string& s)
+{
+  std::string out("\"");
+  for (const char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    if (c == '\n') { out += "\\n"; continue; }
+    out += c;
+  }
+  return out + "\"";
+}
+
+void write_json(std::ostream& os, const std::vector<measurement>& results)
+{
+  std::time_t now = std::time(nullptr);
+  char stamp[32];
+  std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+  os << "{\n"
+     << "  \"benchmark\": \"spinsolve_bench\",\n"
+     << "  \"timestamp\": " << json_string(stamp) << ",\n"
+     << "  \"cpu\": " << json_string(cpu_model()) << ",\n"
+     << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+     << "  \"compiler\": " << json_string(compiler_name()) << ",\n"
+     << "  \"flags\": " << json_string(SPINSOLVE_BENCH_FLAGS) << ",\n"
+#ifdef NDEBUG
+     << "  \"assertions\": false,\n"
+#else
+     << "  \"assertions\": true,\n"
+#endif
+     << "  \"results\": [\n";
+  for (std::size_t i=0; i<results.size(); ++i) {
+    const measurement& m = results[i];
+    os << "    {\"name\": " << json_string(m.name)
+       << ", \"instance\": " << json_string(m.instance)
+       << ", \"kernel\": " << json_string(m.kernel)
+       << ", \"N\": " << m.N
+       << ", \"Ns\": " << m.Ns
+       << ", \"iterations\": " << m.iterations
+       << ", \"seconds\": " << m.seconds
+       << ", \"rate\": " << m.rate
+       << ", \"unit\": " << json_string(m.unit) << "}"
+       << (i+1<results.size() ? "," : "") << "\n";
+  }
+  os << "  ]\n}\n";
+}
+
+void report(std::vector<measurement>& results, const measurement& m)
+{
+  std::cout << std::left << std::setw(16) << m.name
+            << std::setw(24) << m.instance
+            << std::setw(16) << m.kernel
+            << std::right << std::setw(7) << m.N
+            << std::setw(7) << m.Ns
+            << std::setw(14) << std::setprecision(4) << m.rate << " " << m.unit << std::endl;
+  results.push_back(m);
+}
+
+//----------------------------------------------------------------------------
+// the benchmarks
+//----------------------------------------------------------------------------
+void bench_parse(const instance& inst, double min_time, std::vector<measurement>& results)
+{
+  std::size_t N(0);
+  std::pair<std::size_t,double> t = time_loop([&]() {
+    std::istringstream in(inst.text);
+    hamiltonian_type H(in);
+    N = H.size();
+  }, min_time);
+  const double mb = double(inst.text.size())*t.first/1.0e6;
+  report(results, {"parse", inst.name, "", N, 0, t.first, t.second, mb/t.second, "MB/s"});
+  report(results, {"parse", inst.name, "", N, 0, t.first, t.second,
+                   double(inst.terms)*t.first/t.second, "terms/s"});
+}
+
+void bench_energy(const hamiltonian_type& H, const std::string& name,
+                  double min_time, std::vector<measurement>& results)
+{
+  sa_solver solver(H);
+  std::minstd_rand0 gen(42);
+  std::uniform_int_distribution<int> binaries(0, 1);
+  std::vector<int> spins(H.size());
+  for (auto& s : spins) s = binaries(gen);
+  sa_solver_benchmark::set_spins(solver, spins);
+
+  volatile double sink = 0.0;
+  std::pair<std::size_t,double> t = time_loop([&]() {
+    sink = sink + sa_solver_benchmark::compute_energy(solver);
+  }, min_time);
+  report(results, {"compute_energy", name, "reference", H.size(), 0, t.first, t.second,
+                   t.first/t.second, "calls/s"});
+
+  t = time_loop([&]() {
+    double dE = 0.0;
+    for (unsigned i=0; i<H.size(); ++i)
+      dE += sa_solver_benchmark::delta_energy(solver, i);
+    sink = sink + dE;
+  }, min_time);
+  report(results, {"delta_energy", name, "reference", H.size(), 0, t.first*H.size(), t.second,
+                   double(t.first)*H.size()/t.second, "calls/s"});
+}
+
+void bench_run(const hamiltonian_type& H, const std::string& name, std::size_t Ns,
+               double min_time, std::vector<measurement>& results)
+{
+  // as configured, and with Metropolis sweeps only (no n-fold way tail, no
+  // freeze detection) for comparison
+  anneal_options metropolis;
+  metropolis.nfold_acceptance = 0.0;
+  metropolis.freeze_sweeps    = 0;
+  const anneal_options variants[] = {anneal_options(), metropolis};
+
+  for (const auto& options : variants) {
+    sa_solver solver(H);
+    solver.set_options(options);
+    const std::string kernel = solver.kernel_name() +
+      (options.nfold_acceptance > 0 ? "" : "/metropolis");
+    std::size_t seed(0);
+    // the proposals actually made, runs that freeze end before Ns sweeps
+    std::uint64_t attempts(0);
+    volatile double sink = 0.0;
+    std::pair<std::size_t,double> t = time_loop([&]() {
+      // a fresh copy per run, as wrapped_solver_class::run_one does
+      sa_solver s(solver);
+      const result res = s.run(0.1, 3.0, Ns, seed++);
+      attempts += res.stats_.proposals;
+      sink = sink + res.E_;
+    }, min_time);
+    report(results, {"sa_run", name, kernel, H.size(), Ns, t.first, t.second,
+                     double(attempts)/t.second, "flips/s"});
+    report(results, {"sa_run", name, kernel, H.size(), Ns, t.first, t.second,
+                     t.first/t.second, "runs/s"});
+  }
+}
+
+void bench_tabu(const hamiltonian_type& H, const std::string& name, std::size_t Ns,
+                double min_time, std::vector<measurement>& results)
+{
+  const tabu_solver solver(H);
+  std::size_t seed(0);
+  volatile double sink = 0.0;
+  std::pair<std::size_t,double> t = time_loop([&]() {
+    tabu_solver s(solver);
+    sink = sink + s.run(0.1, 3.0, Ns, seed++).E_;
+  }, min_time);
+  const double iterations = double(t.first)*Ns*H.size();
+  report(results, {"tabu_run", name, solver.kernel_name(), H.size(), Ns, t.first, t.second,
+                   iterations/t.second, "flips/s"});
+  report(results, {"tabu_run", name, solver.kernel_name(), H.size(), Ns, t.first, t.second,
+                   t.first/t.second, "runs/s"});
+}
+
+//----------------------------------------------------------------------------
+std::vector<std::size_t> parse_list(const std::string& arg)
+{
+  std::vector<std::size_t> values;
+  std::istringstream in(arg);
+  std::string item;
+  while (std::getline(in, item, ','))
+    values.push_back(std::stoul(item));
+  return values;
+}
+
+int main(int argc, char* argv[])
+{
+  std::string json_file = "spinsolve_bench.json";
+  double min_time = 0.5;
+  std::vector<std::size_t> sweeps = {100, 1000};
+  std::vector<std::size_t> sizes = {16, 32, 64};
+  std::vector<std::string> files;
+#ifdef SPINSOLVE_SOURCE_DIR
+  files.push_back(SPINSOLVE_SOURCE_DIR "/testdata/Instances128Spins/lattice/128random0.lat");
+#endif
+
+  for (int i=1; i<argc; ++i) {
+    const std::string arg(argv[i]);
+    if (arg == "--help" || arg == "-h") {
+      std::cout << "Usage: spinsolve_bench [options] [file.lat ...]\n"
+                << "  --json <file>       write results as JSON (default spinsolve_bench.json)\n"
+                << "  --min-time <s>      minimum time per measurement (default 0.5)\n"
+                << "  --Ns <n,n,...>      sweeps per SA run to measure (default 100,1000)\n"
+                << "  --lattices <L,...>  sizes of the synthetic square lattices (default 16,32,64)\n"
+                << "  --no-testdata       do not include the 128 spin testdata instance\n";
+      return 0;
+    }
+    else if (arg == "--json" && i+1<argc)      json_file = argv[++i];
+    else if (arg == "--min-time" && i+1<argc)  min_time = std::stod(argv[++i]);
+    else if (arg == "--Ns" && i+1<argc)        sweeps = parse_list(argv[++i]);
+    else if (arg == "--lattices" && i+1<argc)  sizes = parse_list(argv[++i]);
+    else if (arg == "--no-testdata")           files.clear();
+    else if (!arg.empty() && arg[0] == '-') {
+      std::cerr << "error: invalid option '" << arg << "'" << std::endl;
+      return 1;
+    }
+    else files.push_back(arg);
+  }
+
+  std::vector<instance> instances;
+  for (const auto& f : files) instances.push_back(read_instance(f));
+  for (const auto L : sizes) instances.push_back(square_lattice(L, L));
+
+  std::cout << "CPU " << cpu_model() << ", " << compiler_name() << std::endl;
+
+  std::vector<measurement> results;
+  for (const auto& inst : instances) {
+    bench_parse(inst, min_time, results);
+    std::istringstream in(inst.text);
+    const hamiltonian_type H(in);
+    bench_energy(H, inst.name, min_time, results);
+    for (const auto Ns : sweeps) {
+      bench_run(H, inst.name, Ns, min_time, results);
+      bench_tabu(H, inst.name, Ns, min_time, results);
+    }
+  }
+
+  std::ofstream out(json_file);
+  write_json(out, results);
+  std::cout << "Results written to " << json_file << std::endl;
+  return 0;
+}
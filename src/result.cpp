@@ -1,5 +1,9 @@
 #include "result.hpp"
+#include "hamiltonian.hpp"
 #include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
 
 std::ostream& operator << (std::ostream& os, result const& res)
 {
@@ -9,3 +13,106 @@ std::ostream& operator << (std::ostream& os, result const& res)
   return os;
 }
 
+spin_format parse_spin_format(const std::string& name)
+{
+  if(name == "internal") return spin_format::internal;
+  if(name == "labels")   return spin_format::labels;
+  if(name == "pairs")    return spin_format::pairs;
+  throw std::invalid_argument("unknown spin format '" + name + "' (use internal, labels or pairs)");
+}
+
+std::string to_string(spin_format format)
+{
+  switch(format){
+  case spin_format::labels: return "labels";
+  case spin_format::pairs:  return "pairs";
+  default:                  return "internal";
+  }
+}
+
+result_writer::result_writer(const hamiltonian_type& H, spin_format format)
+  : H_(&H), format_(format)
+{
+  if(format_ != spin_format::internal)
+    order_ = H.label_order();
+}
+
+void result_writer::operator()(std::ostream& os, result const& res) const
+{
+  switch(format_){
+  case spin_format::internal:
+    os << res;
+    break;
+  case spin_format::labels:
+    os << res.E_ << ' ';
+    for(const auto i : order_)
+      os << res.spins_[i];
+    os << std::endl;
+    break;
+  case spin_format::pairs:
+    os << res.E_;
+    for(const auto i : order_)
+      os << ' ' << H_->label(i) << ':' << res.spins_[i];
+    os << std::endl;
+    break;
+  }
+}
+
+std::vector<result> read_results(std::istream& in, const hamiltonian_type& H, spin_format format)
+{
+  const std::size_t N(H.size());
+  std::vector<unsigned> order;
+  std::unordered_map<std::string,unsigned> index;
+  for(unsigned i = 0; i < N; ++i)
+    index[H.label(i)] = i;
+
+  std::vector<result> results;
+  std::string line;
+  std::size_t count(0);
+  while(std::getline(in, line)){
+    ++count;
+    if(line.empty()) continue;
+    if(line[0] == '#'){
+      const std::string key("spin_format=");
+      const std::size_t pos(line.find(key));
+      if(pos != std::string::npos){
+        std::istringstream name(line.substr(pos + key.size()));
+        std::string value;
+        name >> value;
+        format = parse_spin_format(value);
+      }
+      continue;
+    }
+    const std::string where(" on line " + std::to_string(count));
+    std::istringstream fields(line);
+    result res;
+    if(!(fields >> res.E_))
+      throw std::runtime_error("no energy" + where);
+    res.spins_.assign(N, -1);
+    std::string spins;
+    if(format == spin_format::pairs){
+      while(fields >> spins){
+        const std::size_t colon(spins.rfind(':'));
+        auto it = index.find(spins.substr(0, colon == std::string::npos ? 0 : colon));
+        if(it == index.end() || colon+2 != spins.size())
+          throw std::runtime_error("unknown site '" + spins + "'" + where);
+        res.spins_[it->second] = spins[colon+1] - '0';
+      }
+    }
+    else {
+      fields >> spins;
+      if(spins.size() != N)
+        throw std::runtime_error(std::to_string(spins.size()) + " spins instead of "
+                                 + std::to_string(N) + where);
+      if(format == spin_format::labels && order.empty())
+        order = H.label_order();
+      for(unsigned k = 0; k < N; ++k)
+        res.spins_[format == spin_format::labels ? order[k] : k] = spins[k] - '0';
+    }
+    for(const auto s : res.spins_)
+      if(s != 0 && s != 1)
+        throw std::runtime_error("missing or invalid spin" + where);
+    results.push_back(res);
+  }
+  return results;
+}
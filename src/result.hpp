@@ -1,8 +1,12 @@
 #ifndef RESULT_HPP
 #define RESULT_HPP
 
+#include <string>
 #include <vector>
 #include <iostream>
+#include "solver_stats.hpp"
+
+class hamiltonian_type;
 
 /// a class to store the results of the optimization
 struct result
@@ -13,14 +17,57 @@ struct result
   /// the final spin configuration
   std::vector<int> spins_; // vector<bool> gives horrible performamce hots
 
+  /// what the solver did to get there
+  solver_stats stats_;
+
+  /// the seed of the repetition, identifies it in checkpoints
+  std::uint64_t seed_ = 0;
+
+  /// content hash of the hamiltonian that was solved, 0 for the default
+  /// instance of a solver wrapper
+  std::uint64_t instance_ = 0;
+
   template <typename Archive>
   void serialize(Archive & ar, unsigned)
   {
       ar & E_;
       ar & spins_;
+      ar & stats_;
+      ar & seed_;
+      ar & instance_;
   }
 };
 
 std::ostream& operator << (std::ostream&, result const&);
 
+/// the layout of the spin configuration when writing results
+enum class spin_format {
+  internal,  // dense solver order (same as operator <<)
+  labels,    // spin values sorted by the original site labels
+  pairs      // label:spin pairs sorted by the original site labels
+};
+
+spin_format parse_spin_format(const std::string&);
+std::string to_string(spin_format);
+
+/// writes results using the site labels of the hamiltonian they were solved on,
+/// the label permutation is computed once here so that solvers never remap
+class result_writer
+{
+public:
+  result_writer(const hamiltonian_type&, spin_format);
+
+  void operator()(std::ostream&, result const&) const;
+
+private:
+  const hamiltonian_type* H_;
+  spin_format format_;
+  std::vector<unsigned> order_;
+};
+
+/// reads back a results file written by result_writer, spins in solver order.
+/// Comment lines are skipped, the spin_format= entry of the header line
+/// overrides format. Throws std::runtime_error for lines that do not match H.
+std::vector<result> read_results(std::istream&, const hamiltonian_type&, spin_format);
+
 #endif
@@ -0,0 +1,75 @@
+#include "sa_kernel.hpp"
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// the row widths we compile fixed degree kernels for
+// 4 : square lattice, 6 : cubic lattice and Chimera, 8, 12, 16 : Pegasus-like graphs
+const unsigned fixed_widths[] = {4, 6, 8, 12, 16};
+
+template <typename Coupling, typename Field>
+std::shared_ptr<const annealing_kernel> make_kernel(const hamiltonian_type& H,
+                                                    const std::string& type)
+{
+  const std::size_t degree(H.max_degree());
+
+  if(H.pairwise()){
+    for(const auto W : fixed_widths){
+      if(degree > W) continue;
+      const std::string name(type + "/degree" + std::to_string(W));
+      switch(W){
+      case 4:  return std::make_shared<annealing_kernel_impl<fixed_degree_table<4,Coupling,Field> > >(H, name);
+      case 6:  return std::make_shared<annealing_kernel_impl<fixed_degree_table<6,Coupling,Field> > >(H, name);
+      case 8:  return std::make_shared<annealing_kernel_impl<fixed_degree_table<8,Coupling,Field> > >(H, name);
+      case 12: return std::make_shared<annealing_kernel_impl<fixed_degree_table<12,Coupling,Field> > >(H, name);
+      case 16: return std::make_shared<annealing_kernel_impl<fixed_degree_table<16,Coupling,Field> > >(H, name);
+      }
+    }
+  }
+
+  return std::make_shared<annealing_kernel_impl<coupling_table<Coupling,Field> > >(H, type + "/general");
+}
+
+}
+
+bool integer_couplings_fit(const hamiltonian_type& H)
+{
+  if(!H.integral()) return false;
+  // every term is listed by each of its sites, so total bounds the energy
+  double total(0);
+  for(std::size_t i = 0; i < H.size(); ++i){
+    double sum(0);
+    for(const auto& edge : H[i])
+      sum += std::abs(edge.second);
+    if(2*sum > integer_max_delta) return false;
+    total += sum;
+  }
+  return total < double(std::numeric_limits<std::int32_t>::max()/2);
+}
+
+std::shared_ptr<const annealing_kernel> make_annealing_kernel(const hamiltonian_type& H)
+{
+  if(integer_couplings_fit(H))
+    return make_kernel<std::int16_t, std::int32_t>(H, "int16");
+  else
+    return make_kernel<double, double>(H, "double");
+}
+
+polish_mode parse_polish_mode(const std::string& name)
+{
+  if(name == "none")    return polish_mode::none;
+  if(name == "descent") return polish_mode::descent;
+  if(name == "pairs")   return polish_mode::pairs;
+  throw std::invalid_argument("unknown polish mode '" + name + "' (use none, descent or pairs)");
+}
+
+std::string to_string(polish_mode mode)
+{
+  switch(mode){
+  case polish_mode::descent: return "descent";
+  case polish_mode::pairs:   return "pairs";
+  default:                   return "none";
+  }
+}
@@ -0,0 +1,790 @@
+#ifndef SA_KERNEL_HPP
+#define SA_KERNEL_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include "hamiltonian.hpp"
+#include "solver_stats.hpp"
+
+// Local search applied to the configuration at the end of every anneal
+enum class polish_mode {
+  none,     // the configuration as annealed
+  descent,  // steepest descent to a local minimum for single flips
+  pairs     // and then for flips of two coupled spins
+};
+
+polish_mode parse_polish_mode(const std::string&);
+std::string to_string(polish_mode);
+
+// Tuning of the annealing kernels, the defaults suit the benchmark instances
+struct anneal_options
+{
+  // once fewer than this fraction of the proposals of a sweep are accepted
+  // the rest of the schedule runs on the rejection free n-fold way kernel
+  // (integer couplings only, 0 switches it off)
+  double nfold_acceptance = 0.02;
+
+  // a run is frozen when a window of freeze_sweeps sweeps had fewer than
+  // freeze_acceptance*N flips per sweep that change the energy and ended no
+  // lower than it started, it then ends with a greedy descent instead of
+  // running the remaining sweeps (freeze_sweeps 0 always runs all of them)
+  std::size_t freeze_sweeps = 100;
+  double freeze_acceptance = 0.001;
+
+  polish_mode polish = polish_mode::none;
+
+  template <typename Archive>
+  void serialize(Archive & ar, unsigned)
+  {
+      int mode(static_cast<int>(polish));
+      ar & nfold_acceptance;
+      ar & freeze_sweeps & freeze_acceptance;
+      ar & mode;
+      polish = static_cast<polish_mode>(mode);
+  }
+};
+
+// Compact storage of the couplings used by the annealing kernels.
+//
+// With sigma_i = 1-2*spin_i every term t of the hamiltonian contributes
+//   E_t = c_t * prod_{i in t} sigma_i
+// where c_t = J_t for terms with an even number of spins and -J_t otherwise
+// (the convention of sa_solver::compute_energy). Flipping spin i changes the
+// energy by -2*sigma_i*h_i with the local field
+//   h_i = sum_{t containing i} c_t * prod_{j in t, j!=i} sigma_j
+// so a kernel keeps h up to date and never walks the terms to propose a flip.
+//
+// Coupling is the storage type of c_t, Field the type of h_i and of the energy.
+template <typename Coupling, typename Field>
+struct coupling_table
+{
+  typedef Coupling coupling_type;
+  typedef Field    field_type;
+
+  coupling_table(const hamiltonian_type&);
+
+  std::size_t size() const {return N_;}
+
+  std::size_t N_;
+
+  // two spin terms as rows of (neighbour, coupling), row i is [pair_row_[i], pair_row_[i+1])
+  std::vector<unsigned> pair_row_;
+  std::vector<unsigned> pair_col_;
+  std::vector<Coupling> pair_val_;
+
+  // all other terms (fields and multi spin terms), row i lists the terms containing i
+  std::vector<unsigned> term_row_;
+  std::vector<unsigned> term_ids_;
+  // sites of term t are term_sites_[term_offset_[t], term_offset_[t+1])
+  std::vector<unsigned> term_offset_;
+  std::vector<unsigned> term_sites_;
+  std::vector<Coupling> term_val_;
+
+  // the largest energy change a single flip can produce
+  Field max_delta_;
+};
+
+// exact integer arithmetic for integral instances, couplings in 16 bits
+typedef coupling_table<std::int16_t, std::int32_t> integer_couplings;
+// general instances
+typedef coupling_table<double, double> real_couplings;
+
+// The integer kernels fill a Boltzmann table of max_delta entries every sweep
+// and keep fields and energies in 32 bits, so they are only used when no
+// flip changes the energy by more than this.
+const double integer_max_delta = 4096;
+
+// H is integral and its energy changes and total energy fit the integer kernels
+bool integer_couplings_fit(const hamiltonian_type& H);
+
+template <typename Coupling, typename Field>
+coupling_table<Coupling,Field>::coupling_table(const hamiltonian_type& H)
+  : N_(H.size()), max_delta_(0)
+{
+  pair_row_.reserve(N_+1);
+  term_row_.reserve(N_+1);
+  term_offset_.push_back(0);
+
+  // every term is listed by each of its sites, multi spin terms are
+  // numbered when met at their first (smallest) site
+  std::vector<std::vector<unsigned> > terms_of(N_);
+
+  for(unsigned i = 0; i < N_; ++i){
+    pair_row_.push_back(pair_col_.size());
+    Field sum(0);
+    for(const auto& edge : H[i]){
+      const auto& sites = edge.first;
+      const Coupling c(sites.size()%2 ? -edge.second : edge.second);
+      sum += std::abs(Field(c));
+      if(sites.size() == 2 && sites[0] != sites[1]){
+        pair_col_.push_back(sites[0] == i ? sites[1] : sites[0]);
+        pair_val_.push_back(c);
+      }
+      else if(sites[0] == i){
+        const unsigned t(term_val_.size());
+        term_val_.push_back(c);
+        term_sites_.insert(term_sites_.end(), sites.begin(), sites.end());
+        term_offset_.push_back(term_sites_.size());
+        for(const auto s : sites)
+          if(terms_of[s].empty() || terms_of[s].back() != t)
+            terms_of[s].push_back(t);
+      }
+    }
+    max_delta_ = std::max(max_delta_, Field(2*sum));
+  }
+  pair_row_.push_back(pair_col_.size());
+
+  for(unsigned i = 0; i < N_; ++i){
+    term_row_.push_back(term_ids_.size());
+    term_ids_.insert(term_ids_.end(), terms_of[i].begin(), terms_of[i].end());
+  }
+  term_row_.push_back(term_ids_.size());
+}
+
+// Pairwise couplings of lattices with a small maximum degree W (grids, Chimera,
+// Pegasus-like graphs) stored as fixed width rows, so that the neighbour loops
+// have a compile time trip count and are unrolled. Rows of spins with fewer
+// than W neighbours are padded with the spin itself and a zero coupling.
+template <unsigned W, typename Coupling, typename Field>
+struct fixed_degree_table
+{
+  typedef Coupling coupling_type;
+  typedef Field    field_type;
+
+  // H must be pairwise with max_degree() <= W
+  fixed_degree_table(const hamiltonian_type&);
+
+  std::size_t size() const {return N_;}
+
+  std::size_t N_;
+
+  // neighbour k of spin i is nbr_[i*W+k] with coupling val_[i*W+k]
+  std::vector<unsigned> nbr_;
+  std::vector<Coupling> val_;
+
+  Field max_delta_;
+};
+
+template <unsigned W, typename Coupling, typename Field>
+fixed_degree_table<W,Coupling,Field>::fixed_degree_table(const hamiltonian_type& H)
+  : N_(H.size()), nbr_(N_*W), val_(N_*W, Coupling(0)), max_delta_(0)
+{
+  for(unsigned i = 0; i < N_; ++i){
+    assert(H[i].size() <= W);
+    Field sum(0);
+    unsigned k(0);
+    for(const auto& edge : H[i]){
+      const auto& sites = edge.first;
+      nbr_[i*W+k] = sites[0] == i ? sites[1] : sites[0];
+      val_[i*W+k] = Coupling(edge.second);
+      sum += std::abs(Field(val_[i*W+k]));
+      ++k;
+    }
+    for(; k < W; ++k)
+      nbr_[i*W+k] = i;
+    max_delta_ = std::max(max_delta_, Field(2*sum));
+  }
+}
+
+// calls f(0), ..., f(K-1), expanded at compile time
+template <unsigned K>
+struct unrolled
+{
+  template <typename F>
+  static inline void apply(F& f) {unrolled<K-1>::apply(f); f(K-1);}
+};
+
+template <>
+struct unrolled<0>
+{
+  template <typename F>
+  static inline void apply(F&) {}
+};
+
+// product of sigma over the sites of multi spin term t
+template <typename Table>
+inline int term_sign(const Table& J, const unsigned t, const std::vector<int>& spins)
+{
+  int tmp(0);
+  for(unsigned k = J.term_offset_[t]; k < J.term_offset_[t+1]; ++k)
+    tmp ^= spins[J.term_sites_[k]];
+  return 1-2*tmp;
+}
+
+// fill the local fields for the configuration spins and return its energy
+template <typename Table>
+typename Table::field_type local_fields(const Table& J,
+                                        const std::vector<int>& spins,
+                                        std::vector<typename Table::field_type>& h)
+{
+  typedef typename Table::field_type field_type;
+  h.assign(J.size(), field_type(0));
+  field_type E(0);
+
+  for(unsigned i = 0; i < J.size(); ++i){
+    const int si(1-2*spins[i]);
+    for(unsigned k = J.pair_row_[i]; k < J.pair_row_[i+1]; ++k){
+      const unsigned j(J.pair_col_[k]);
+      const field_type c(J.pair_val_[k]);
+      h[i] += c*(1-2*spins[j]);
+      if(i < j)
+        E += c*si*(1-2*spins[j]);
+    }
+  }
+
+  for(unsigned t = 0; t < J.term_val_.size(); ++t){
+    const field_type c(J.term_val_[t]);
+    const int P(term_sign(J, t, spins));
+    E += c*P;
+    for(unsigned k = J.term_offset_[t]; k < J.term_offset_[t+1]; ++k){
+      const unsigned j(J.term_sites_[k]);
+      h[j] += c*P*(1-2*spins[j]);
+    }
+  }
+
+  return E;
+}
+
+template <unsigned W, typename Coupling, typename Field>
+Field local_fields(const fixed_degree_table<W,Coupling,Field>& J,
+                   const std::vector<int>& spins,
+                   std::vector<Field>& h)
+{
+  h.assign(J.size(), Field(0));
+  Field E(0);
+
+  for(unsigned i = 0; i < J.size(); ++i){
+    const unsigned* nbr(&J.nbr_[i*W]);
+    const Coupling* val(&J.val_[i*W]);
+    Field hi(0);
+    auto add = [&](unsigned k){hi += Field(val[k])*(1-2*spins[nbr[k]]);};
+    unrolled<W>::apply(add);
+    h[i] = hi;
+    E += (1-2*spins[i])*hi;
+  }
+
+  // every coupling was seen from both of its spins
+  return E/2;
+}
+
+// energy change of flipping spin i
+template <typename Field>
+inline Field flip_delta(const std::vector<int>& spins,
+                        const std::vector<Field>& h,
+                        const unsigned i)
+{
+  return (4*spins[i]-2)*h[i];
+}
+
+// flip spin i and update the local fields of the spins it interacts with
+template <typename Table>
+inline void flip_spin(const Table& J,
+                      std::vector<int>& spins,
+                      std::vector<typename Table::field_type>& h,
+                      const unsigned i)
+{
+  typedef typename Table::field_type field_type;
+  const int si(1-2*spins[i]);
+
+  for(unsigned k = J.pair_row_[i]; k < J.pair_row_[i+1]; ++k)
+    h[J.pair_col_[k]] -= 2*si*field_type(J.pair_val_[k]);
+
+  for(unsigned k = J.term_row_[i]; k < J.term_row_[i+1]; ++k){
+    const unsigned t(J.term_ids_[k]);
+    const field_type c(J.term_val_[t]);
+    const int P(term_sign(J, t, spins));
+    for(unsigned m = J.term_offset_[t]; m < J.term_offset_[t+1]; ++m){
+      const unsigned j(J.term_sites_[m]);
+      if(j != i)
+        h[j] -= 2*c*P*(1-2*spins[j]);
+    }
+  }
+
+  spins[i] ^= 1;
+}
+
+template <unsigned W, typename Coupling, typename Field>
+inline void flip_spin(const fixed_degree_table<W,Coupling,Field>& J,
+                      std::vector<int>& spins,
+                      std::vector<Field>& h,
+                      const unsigned i)
+{
+  const int si2(2-4*spins[i]);
+  const unsigned* nbr(&J.nbr_[i*W]);
+  const Coupling* val(&J.val_[i*W]);
+  auto update = [&](unsigned k){h[nbr[k]] -= si2*Field(val[k]);};
+  unrolled<W>::apply(update);
+  spins[i] ^= 1;
+}
+
+// calls f(j) for every spin j whose local field changes when spin i flips
+// (possibly more than once, and i itself for padded fixed degree rows)
+template <typename Table, typename F>
+inline void for_each_neighbour(const Table& J, const unsigned i, F f)
+{
+  for(unsigned k = J.pair_row_[i]; k < J.pair_row_[i+1]; ++k)
+    f(J.pair_col_[k]);
+
+  for(unsigned k = J.term_row_[i]; k < J.term_row_[i+1]; ++k){
+    const unsigned t(J.term_ids_[k]);
+    for(unsigned m = J.term_offset_[t]; m < J.term_offset_[t+1]; ++m)
+      if(J.term_sites_[m] != i)
+        f(J.term_sites_[m]);
+  }
+}
+
+template <unsigned W, typename Coupling, typename Field, typename F>
+inline void for_each_neighbour(const fixed_degree_table<W,Coupling,Field>& J,
+                               const unsigned i, F f)
+{
+  const unsigned* nbr(&J.nbr_[i*W]);
+  for(unsigned k = 0; k < W; ++k)
+    f(nbr[k]);
+}
+
+// Metropolis acceptance probability exp(-beta*dE) for uphill moves.
+// Integer energies can only take a few values, so a table is filled once per
+// sweep instead of calling exp for every proposal.
+template <typename Field, bool Integral = std::is_integral<Field>::value>
+class boltzmann_factor
+{
+public:
+  boltzmann_factor(Field) {}
+  void set_beta(const double beta) {beta_ = beta;}
+  double operator()(const Field dE) const {return std::exp(-beta_*dE);}
+private:
+  double beta_;
+};
+
+template <typename Field>
+class boltzmann_factor<Field, true>
+{
+public:
+  boltzmann_factor(const Field max_delta) : table_(max_delta+1) {}
+  void set_beta(const double beta) {
+    for(std::size_t dE = 1; dE < table_.size(); ++dE)
+      table_[dE] = std::exp(-beta*double(dE));
+  }
+  double operator()(const Field dE) const {return table_[dE];}
+private:
+  std::vector<double> table_;
+};
+
+// Flip every spin that lowers the energy, in index order, until none is
+// left (a local minimum for single flips). Returns the number of flips.
+template <typename Table>
+std::uint64_t greedy_descent(const Table& J,
+                             std::vector<int>& spins,
+                             std::vector<typename Table::field_type>& h,
+                             typename Table::field_type& E)
+{
+  typedef typename Table::field_type field_type;
+  std::uint64_t flips(0);
+  bool improved(true);
+  while(improved){
+    improved = false;
+    for(unsigned i = 0; i < J.size(); ++i){
+      const field_type dE(flip_delta(spins, h, i));
+      if(dE < 0){
+        flip_spin(J, spins, h, i);
+        E += dE;
+        ++flips;
+        improved = true;
+      }
+    }
+  }
+  return flips;
+}
+
+// Steepest descent: flip the spin that lowers the energy most until none
+// does. With pairs, then look for a spin i and a spin j coupled to it whose
+// joint flip lowers the energy (single flips of uncoupled spins were already
+// tried) and descend again after each one. Returns the number of flips.
+template <typename Table>
+std::uint64_t polish(const Table& J,
+                     std::vector<int>& spins,
+                     std::vector<typename Table::field_type>& h,
+                     typename Table::field_type& E,
+                     const bool pairs)
+{
+  typedef typename Table::field_type field_type;
+  const unsigned N(J.size());
+  std::uint64_t flips(0);
+
+  bool improved(true);
+  while(improved){
+    improved = false;
+    for(;;){
+      unsigned best(N);
+      field_type best_dE(0);
+      for(unsigned i = 0; i < N; ++i){
+        const field_type dE(flip_delta(spins, h, i));
+        if(dE < best_dE){
+          best_dE = dE;
+          best = i;
+        }
+      }
+      if(best == N) break;
+      flip_spin(J, spins, h, best);
+      E += best_dE;
+      ++flips;
+    }
+    if(!pairs) break;
+
+    for(unsigned i = 0; i < N; ++i){
+      // flip i on trial, the change of flipping j as well is then flip_delta(j)
+      const field_type dE_i(flip_delta(spins, h, i));
+      flip_spin(J, spins, h, i);
+      unsigned best(N);
+      field_type best_dE(0);
+      for_each_neighbour(J, i, [&](const unsigned j){
+        if(j == i) return;
+        const field_type dE(dE_i + flip_delta(spins, h, j));
+        if(dE < best_dE){
+          best_dE = dE;
+          best = j;
+        }
+      });
+      if(best == N){
+        flip_spin(J, spins, h, i);
+        continue;
+      }
+      flip_spin(J, spins, h, best);
+      E += best_dE;
+      flips += 2;
+      improved = true;
+    }
+  }
+  return flips;
+}
+
+// Watches the flips of a run for anneal_options::freeze_sweeps
+template <typename Field>
+class freeze_monitor
+{
+public:
+  freeze_monitor(const anneal_options& options, const unsigned N, const Field E)
+    : window_(options.freeze_sweeps)
+    , limit_(options.freeze_acceptance*N*options.freeze_sweeps)
+    , sweeps_(0), changes_(0), start_(E), frozen_(false) {}
+
+  void flip(const Field dE) {if(dE != 0) ++changes_;}
+
+  // at the end of every sweep, true once the run is frozen
+  bool sweep(const Field E) {
+    if(!window_ || ++sweeps_ < window_) return false;
+    frozen_ = changes_ < limit_ && !(E < start_);
+    sweeps_ = 0;
+    changes_ = 0;
+    start_ = E;
+    return frozen_;
+  }
+
+  bool frozen() const {return frozen_;}
+
+private:
+  std::size_t window_;
+  double limit_;
+  std::size_t sweeps_;
+  std::uint64_t changes_;
+  Field start_;
+  bool frozen_;
+};
+
+// The n-fold way (Bortz, Kalos and Lebowitz) needs a bucket per possible
+// energy change, only integer fields with few of them qualify
+const long nfold_max_delta = 256;
+
+template <typename Table>
+bool nfold_available(const Table& J)
+{
+  typedef typename Table::field_type field_type;
+  return std::is_integral<field_type>::value && J.max_delta_ <= field_type(nfold_max_delta);
+}
+
+// Rejection free continuation of the anneal from sweep s0 to Ns-1, same
+// schedule. The spins are kept in buckets by their energy change dE, every
+// spin flips at the Metropolis rate min(1, exp(-beta*dE)) per sweep, so the
+// next flip is drawn from the buckets in proportion to count*rate and the
+// time to it (in sweeps) is exponential with the total rate. A flip drawn
+// beyond the end of the sweep is dropped and the time advances to the next
+// sweep (and beta), which is exact since the waiting time has no memory.
+// The total rate is updated as spins change bucket and recomputed once per
+// sweep, and a flip is drawn from the non empty buckets only.
+// Stops when freeze reports the run frozen. Adds the flips to accepted and
+// returns the sweep it stopped at (Ns if it ran to the end).
+template <typename Table, typename Generator>
+std::size_t nfold_anneal(const Table& J,
+                         std::vector<int>& spins,
+                         std::vector<typename Table::field_type>& h,
+                         typename Table::field_type& E,
+                         const std::size_t s0,
+                         const double beta0,
+                         const double beta1,
+                         const std::size_t Ns,
+                         Generator& rng,
+                         std::uniform_real_distribution<double>& realnums,
+                         freeze_monitor<typename Table::field_type>& freeze,
+                         std::uint64_t& accepted)
+{
+  typedef typename Table::field_type field_type;
+
+  const unsigned N(J.size());
+  const long offset(static_cast<long>(J.max_delta_));
+  const std::size_t B(2*offset+1);
+
+  const unsigned none(~0u);
+
+  // bucket b holds the spins with dE == b-offset, spin i is at
+  // members[bucket[i]][position[i]]; the non empty buckets are listed in
+  // occupied, bucket b at occupied[where[b]]
+  std::vector<std::vector<unsigned> > members(B);
+  std::vector<unsigned> bucket(N), position(N);
+  std::vector<double> rate(B, 1.0);
+  std::vector<unsigned> occupied;
+  std::vector<unsigned> where(B, none);
+
+  auto bucket_of = [&](const unsigned j){
+    return static_cast<unsigned>(static_cast<long>(flip_delta(spins, h, j)) + offset);
+  };
+  auto insert = [&](const unsigned j, const unsigned b){
+    position[j] = members[b].size();
+    members[b].push_back(j);
+    bucket[j] = b;
+    if(members[b].size() == 1){
+      where[b] = occupied.size();
+      occupied.push_back(b);
+    }
+  };
+  auto erase = [&](const unsigned j){
+    const unsigned b(bucket[j]);
+    std::vector<unsigned>& from(members[b]);
+    const unsigned last(from.back());
+    from[position[j]] = last;
+    position[last] = position[j];
+    from.pop_back();
+    if(from.empty()){
+      const unsigned moved(occupied.back());
+      occupied[where[b]] = moved;
+      where[moved] = where[b];
+      occupied.pop_back();
+      where[b] = none;
+    }
+  };
+  auto total_rate = [&](){
+    double R(0.0);
+    for(const auto b : occupied)
+      R += members[b].size()*rate[b];
+    return R;
+  };
+
+  for(unsigned i = 0; i < N; ++i)
+    insert(i, bucket_of(i));
+
+  // sum of count*rate over the buckets
+  double R(0.0);
+  auto reclassify = [&](const unsigned j){
+    const unsigned b(bucket_of(j));
+    if(b == bucket[j]) return;
+    R += rate[b] - rate[bucket[j]];
+    erase(j);
+    insert(j, b);
+  };
+
+  for(std::size_t s = s0; s < Ns; ++s){
+    const double beta(beta0 + (beta1-beta0)/(Ns-1)*s);
+    for(long dE = 1; dE <= offset; ++dE)
+      rate[dE+offset] = std::exp(-beta*double(dE));
+    R = total_rate();
+
+    double left(1.0);
+    for(;;){
+      if(R <= 0.0) break;
+
+      const double dt(-std::log(1.0 - realnums(rng))/R);
+      if(dt >= left) break;
+      left -= dt;
+
+      // the bucket, then the spin in it from the rest of the same number
+      double x(realnums(rng)*R);
+      unsigned b(none);
+      for(const auto c : occupied){
+        const double w(members[c].size()*rate[c]);
+        if(w <= 0.0) continue;
+        b = c;
+        if(x < w) break;
+        x -= w;
+      }
+      // only rounding of the updated total leaves nothing to flip
+      if(b == none) break;
+      const std::size_t k(std::min(members[b].size()-1, static_cast<std::size_t>(x/rate[b])));
+      const unsigned i(members[b][k]);
+
+      const field_type dE(static_cast<long>(b) - offset);
+      E += dE;
+      freeze.flip(dE);
+      flip_spin(J, spins, h, i);
+      reclassify(i);
+      for_each_neighbour(J, i, reclassify);
+      ++accepted;
+    }
+
+    if(freeze.sweep(E))
+      return s+1;
+  }
+
+  return Ns;
+}
+
+// Metropolis simulated annealing from the configuration in spins,
+// linear schedule in beta from beta0 to beta1 over Ns sweeps. Once the
+// acceptance of a sweep drops below options.nfold_acceptance the remaining
+// sweeps run on the n-fold way kernel where available. A frozen run ends
+// early with a greedy descent, stats.sweeps counts the sweeps it ran.
+// Returns the energy of the final configuration, counters go to stats.
+template <typename Table, typename Generator>
+typename Table::field_type anneal(const Table& J,
+                                  std::vector<int>& spins,
+                                  const double beta0,
+                                  const double beta1,
+                                  const std::size_t Ns,
+                                  Generator& rng,
+                                  std::uniform_real_distribution<double>& realnums,
+                                  const anneal_options& options,
+                                  solver_stats& stats)
+{
+  typedef typename Table::field_type field_type;
+
+  std::vector<field_type> h;
+  field_type E(local_fields(J, spins, h));
+
+  boltzmann_factor<field_type> boltzmann(J.max_delta_);
+  const unsigned N(J.size());
+  const bool nfold(options.nfold_acceptance > 0 && nfold_available(J));
+  const std::uint64_t nfold_below(static_cast<std::uint64_t>(options.nfold_acceptance*N));
+
+  std::uint64_t accepted(0);
+  freeze_monitor<field_type> freeze(options, N, E);
+  std::size_t sweeps(Ns);
+
+  for(unsigned s = 0; s < Ns; ++s){
+    boltzmann.set_beta(beta0 + (beta1-beta0)/(Ns-1)*s);
+    const std::uint64_t before(accepted);
+    for(unsigned i = 0; i < N; ++i){
+      field_type dE;
+      {
+        phase_timer t(stats.delta_ns);
+        dE = flip_delta(spins, h, i);
+      }
+      bool accept(dE <= 0);
+      if(!accept){
+        phase_timer t(stats.rng_ns);
+        accept = realnums(rng) < boltzmann(dE);
+      }
+      if(accept){
+        flip_spin(J, spins, h, i);
+        E += dE;
+        ++accepted;
+        freeze.flip(dE);
+      }
+    }
+    if(freeze.sweep(E)){
+      sweeps = s+1;
+      break;
+    }
+    if(nfold && s+1 < Ns && accepted-before < nfold_below){
+      sweeps = nfold_anneal(J, spins, h, E, s+1, beta0, beta1, Ns, rng, realnums,
+                            freeze, accepted);
+      stats.nfold_sweeps += sweeps-s-1;
+      break;
+    }
+  }
+
+  if(freeze.frozen()){
+    accepted += greedy_descent(J, spins, h, E);
+    ++stats.frozen;
+  }
+
+  stats.sweeps    += sweeps;
+  stats.proposals += sweeps*N;
+  stats.accepted  += accepted;
+
+  return E;
+}
+
+// Type erased annealing kernel, one instance is built per hamiltonian and
+// shared (read only) by all the solver copies running on it.
+class annealing_kernel
+{
+public:
+  typedef std::minstd_rand0 generator_type;
+
+  virtual ~annealing_kernel() {}
+
+  // anneal the configuration in spins and return its final energy
+  virtual double anneal(std::vector<int>& spins,
+                        const double beta0,
+                        const double beta1,
+                        const std::size_t Ns,
+                        generator_type& rng,
+                        std::uniform_real_distribution<double>& realnums,
+                        const anneal_options& options,
+                        solver_stats& stats) const = 0;
+
+  // polish the configuration in spins and return its energy
+  virtual double polish(std::vector<int>& spins,
+                        const polish_mode mode,
+                        solver_stats& stats) const = 0;
+
+  // short description of the storage, e.g. "int16/degree6"
+  virtual std::string name() const = 0;
+};
+
+template <typename Table>
+class annealing_kernel_impl : public annealing_kernel
+{
+public:
+  annealing_kernel_impl(const hamiltonian_type& H, const std::string& name)
+    : J_(H), name_(name) {}
+
+  double anneal(std::vector<int>& spins,
+                const double beta0,
+                const double beta1,
+                const std::size_t Ns,
+                generator_type& rng,
+                std::uniform_real_distribution<double>& realnums,
+                const anneal_options& options,
+                solver_stats& stats) const
+  {
+    return ::anneal(J_, spins, beta0, beta1, Ns, rng, realnums, options, stats);
+  }
+
+  double polish(std::vector<int>& spins,
+                const polish_mode mode,
+                solver_stats& stats) const
+  {
+    std::vector<typename Table::field_type> h;
+    typename Table::field_type E(local_fields(J_, spins, h));
+    if(mode != polish_mode::none)
+      stats.polish_flips += ::polish(J_, spins, h, E, mode == polish_mode::pairs);
+    return E;
+  }
+
+  std::string name() const {return name_;}
+
+private:
+  Table J_;
+  std::string name_;
+};
+
+// Pick the fastest kernel for H: integer couplings if integer_couplings_fit(H)
+// or real ones, and fixed width rows for pairwise lattices of small degree.
+std::shared_ptr<const annealing_kernel> make_annealing_kernel(const hamiltonian_type& H);
+
+#endif
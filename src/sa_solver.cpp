@@ -1,11 +1,27 @@
 #include "sa_solver.hpp"
 #include <chrono>
 #include <random>
+#include <cassert>
+#include <stdexcept>
 
-sa_solver::sa_solver(const hamiltonian_type& H)
-  : N_(H.size())
+sa_solver::sa_solver(const hamiltonian_type& H, const anneal_options& options)
+  : N_(H.size()), options_(options)
 {
   H_ = std::make_shared<hamiltonian_type>(H);
+  kernel_ = make_annealing_kernel(H);
+}
+
+sa_solver sa_solver::clone() const
+{
+  sa_solver copy;
+  copy.N_ = N_;
+  copy.options_ = options_;
+  copy.warm_ = warm_;
+  if (H_) {
+    copy.H_ = std::make_shared<hamiltonian_type>(*H_);
+    copy.kernel_ = make_annealing_kernel(*copy.H_);
+  }
+  return copy;
 }
 
 result sa_solver::run(
@@ -33,30 +49,48 @@ result sa_solver::run(
   // stop STL from reallocating space as vector grows
   spins_.reserve(N_);
 
-  // generate N random binary states
-  for(unsigned i = 0; i < N_; ++i)
-    spins_.push_back(binaries(linear_congruential_generator));
-
-  double E = compute_energy();
-
-  for(unsigned s = 0; s < Ns; ++s){
-    const double beta(beta0 + (beta1-beta0)/(Ns-1)*s);
-    for(unsigned i = 0; i < N_; ++i){
-      const double dE(delta_energy(i));
-      if(dE <= 0.0 || realnums(linear_congruential_generator) < std::exp(-beta*dE)){
-        spins_[i] = spins_[i] ^ 1;
-        E += dE;
-      }
-    }
-  }
-  
+  // generate N random binary states, or take those of the warm start
+  if(warm_)
+    warm_->initial(spins_, seed, linear_congruential_generator);
+  else
+    for(unsigned i = 0; i < N_; ++i)
+      spins_.push_back(binaries(linear_congruential_generator));
+
   result res;
+  res.stats_.repetitions = 1;
+  res.seed_ = seed;
+
+  double E(0.0);
+  if (kernel_) {
+    hardware_counters hw;
+    E = kernel_->anneal(spins_, beta0, beta1, Ns, linear_congruential_generator, realnums,
+                        options_, res.stats_);
+    if (options_.polish != polish_mode::none)
+      E = kernel_->polish(spins_, options_.polish, res.stats_);
+    hw.stop(res.stats_);
+  }
+
+  assert(std::abs(E - compute_energy()) < 1e-6*(1.0 + std::abs(E)));
+
   res.E_=E;
   res.spins_.swap(spins_);
   return res;
 
 }
 
+void sa_solver::set_warm_start(std::shared_ptr<const warm_start> warm)
+{
+  if (warm && warm->empty()) warm.reset();
+  if (warm) warm->check(N_);
+  warm_ = warm;
+}
+
+void sa_solver::polish(result& res, const polish_mode mode) const
+{
+  if (!kernel_ || mode == polish_mode::none) return;
+  res.E_ = kernel_->polish(res.spins_, mode, res.stats_);
+}
+
 double sa_solver::compute_energy() const
 {
   double E(0.0);
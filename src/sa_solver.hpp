@@ -4,6 +4,8 @@
 #include <memory>
 #include "hamiltonian.hpp"
 #include "result.hpp"
+#include "sa_kernel.hpp"
+#include "warm_start.hpp"
 
 //#define FORCE_HAMILTONIAN_COPY 1
 
@@ -12,11 +14,13 @@ class sa_solver
 // Input: Hamiltonian of the spin glass (when constructing a class object)
 // Ouput: Energy and Spin configuration (accessible via get_config())
 //
-// run(...) initialized and runs SA
+// run(...) initialized and runs SA, from random spins or from the states
+// of a warm start
 {
 public:
 
   typedef result result_type;
+  typedef anneal_options options_type;
 
   // empty constructor required by HPX factory create function
   sa_solver() : N_(0) { };
@@ -28,18 +32,51 @@ public:
     H_     = std::make_shared<hamiltonian_type>(*other.H_.get());
 #else
     H_     = other.H_;
+#endif
+#ifdef FORCE_HAMILTONIAN_COPY
+    if (other.kernel_) kernel_ = make_annealing_kernel(*H_);
+#else
+    kernel_ = other.kernel_;
 #endif
     spins_ = other.spins_;
+    options_ = other.options_;
+    warm_ = other.warm_;
   }
 
   // initialize sa solver with hamiltonian
-  sa_solver(const hamiltonian_type&);
+  sa_solver(const hamiltonian_type&, const anneal_options& = anneal_options());
 
   //single run of sa from random initial state on hamiltonian H_
+  //(or from a warm start state, beta0 is then an intermediate temperature)
   result run(const double, const double, const std::size_t, const std::size_t);
 
+  // local search from the configuration of res (e.g. for a chosen subset
+  // of the results of runs without polish), updates its energy and stats
+  void polish(result&, const polish_mode) const;
+
+  // deep copy with its own hamiltonian and coupling tables, allocated by
+  // the calling thread (first touch, for one replica per NUMA domain)
+  sa_solver clone() const;
+
+  // kernel tuning used by the following runs
+  void set_options(const anneal_options& options) { options_ = options; }
+  const anneal_options& options() const { return options_; }
+
+  // start the following runs from these states (null or empty for random
+  // spins), throws std::invalid_argument if a state does not have N spins
+  void set_warm_start(std::shared_ptr<const warm_start>);
+
+  // name of the sweep kernel selected for the hamiltonian
+  std::string kernel_name() const { return kernel_ ? kernel_->name() : "none"; }
+
 private:
 
+  // the micro benchmarks time the private energy functions directly
+  friend class sa_solver_benchmark;
+
+  // reference implementations on the full hamiltonian, the sweeps use
+  // the local fields of the coupling tables instead
+
   //compute total energy
   double compute_energy() const;
 
@@ -48,8 +85,16 @@ private:
 
    std::size_t N_;
    std::shared_ptr<hamiltonian_type> H_;
-  
+
+  // compact couplings and sweep kernel chosen for H_
+  // (integer or real arithmetic, fixed degree rows or general terms)
+  std::shared_ptr<const annealing_kernel> kernel_;
+
   std::vector<int> spins_;
+
+  anneal_options options_;
+
+  std::shared_ptr<const warm_start> warm_;
 };
 
 result solve(const hamiltonian_type& H,
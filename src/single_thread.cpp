@@ -12,11 +12,15 @@
 #include <string>
 #include <iostream>
 #include <chrono>
+#include <fstream>
+#include <stdexcept>
 
 // Solver related includes
 #include "hamiltonian.hpp"
 #include "result.hpp"
 #include "sa_solver.hpp"
+#include "tabu_solver.hpp"
+#include "warm_start.hpp"
 
 // Wrapping solver in an HPX framework
 #include "solver_wrapper.hpp"
@@ -70,6 +74,52 @@ int main(int argc, char* argv[])
     "A logarithmic estimate of the computational requirements of a single solve step\n"
     "This figure is used as a helper to decide how to split up repetitions/iterations between threads\n"
     );
+  desc.add_options()
+    ("spin-format",
+    boost::program_options::value<std::string>()->default_value("internal"),
+    "How spins are written to the output file (internal, labels or pairs)"
+    );
+  desc.add_options()
+    ("engine",
+    boost::program_options::value<std::string>()->default_value("sa"),
+    "The solver to run, sa (simulated annealing) or tabu (tabu search, Ns sweeps of\n"
+    "single flips, the temperatures are ignored)"
+    );
+  desc.add_options()
+    ("polish",
+    boost::program_options::value<std::string>()->default_value("none"),
+    "Local search on every result after the anneal (none, descent or pairs)"
+    );
+  desc.add_options()
+    ("nfold-acceptance",
+    boost::program_options::value<double>()->default_value(0.02),
+    "Acceptance below which the rest of an anneal runs rejection free (0 = never)"
+    );
+  desc.add_options()
+    ("freeze-sweeps",
+    boost::program_options::value<std::size_t>()->default_value(100),
+    "Sweeps without progress after which an anneal counts as frozen (0 = never)"
+    );
+  desc.add_options()
+    ("warm-start",
+    boost::program_options::value<std::string>()->default_value(""),
+    "Start the runs from the configurations of this output file instead of random spins"
+    );
+  desc.add_options()
+    ("warm-top",
+    boost::program_options::value<std::size_t>()->default_value(16),
+    "Number of lowest distinct configurations of the warm start file used (0 = all)"
+    );
+  desc.add_options()
+    ("warm-beta",
+    boost::program_options::value<double>()->default_value(1.0),
+    "Inverse temperature warm started runs begin at (replaces beta0)"
+    );
+  desc.add_options()
+    ("warm-randomise",
+    boost::program_options::value<double>()->default_value(0.0),
+    "Fraction of the spins of a warm start configuration flipped before a run"
+    );
 
   boost::program_options::variables_map vm; 
   boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc),  vm); 
@@ -77,11 +127,18 @@ int main(int argc, char* argv[])
   const std::string infile  = vm["input"].as<std::string>();
   const std::string outfile = vm["output"].as<std::string>();
   const uint64_t Ns         = vm["Ns"].as<uint64_t>();
-  const double beta0        = vm["beta0"].as<double>();
+  const std::string warm_file = vm["warm-start"].as<std::string>();
+  const double beta0        = warm_file.empty() ? vm["beta0"].as<double>() : vm["warm-beta"].as<double>();
   const double beta1        = vm["beta1"].as<double>();
   const uint64_t num_rep    = vm["repetitions"].as<uint64_t>();
   //
   const double complexity   = vm["complexity"].as<double>();
+  const spin_format format  = parse_spin_format(vm["spin-format"].as<std::string>());
+  anneal_options options;
+  options.nfold_acceptance  = vm["nfold-acceptance"].as<double>();
+  options.freeze_sweeps     = vm["freeze-sweeps"].as<std::size_t>();
+  options.polish            = parse_polish_mode(vm["polish"].as<std::string>());
+  const std::string engine  = vm["engine"].as<std::string>();
 
   int rank=0;
 
@@ -98,6 +155,21 @@ int main(int argc, char* argv[])
   //
   const hamiltonian_type H(infile);
 
+  std::shared_ptr<const warm_start> warm;
+  if (!warm_file.empty()) {
+    try {
+      std::ifstream warm_in(warm_file);
+      if (!warm_in) throw std::runtime_error("cannot open " + warm_file);
+      warm = std::make_shared<const warm_start>(make_warm_start(read_results(warm_in, H, format),
+          vm["warm-top"].as<std::size_t>(), vm["warm-randomise"].as<double>()));
+      warm->check(H.size());
+    }
+    catch (std::exception &e) {
+      std::cout << "error: warm start " << warm_file << " : " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
   //
   // Prepare putput file
   //
@@ -108,6 +180,7 @@ int main(int argc, char* argv[])
     + " beta0=" + std::to_string(beta0)
     + " beta1=" + std::to_string(beta1)
     + " num_rep=" + std::to_string(num_rep)
+    + " spin_format=" + to_string(format)
     << std::endl;
 
   // start timer
@@ -122,8 +195,16 @@ int main(int argc, char* argv[])
     //
     // create a single local solver instance
     //
-    sa_solver solver(H);
-    x.push_back(solver.run(beta0, beta1, Ns, i));
+    if (engine == "tabu") {
+      tabu_solver solver(H);
+      solver.set_warm_start(warm);
+      x.push_back(solver.run(beta0, beta1, Ns, i));
+    }
+    else {
+      sa_solver solver(H, options);
+      solver.set_warm_start(warm);
+      x.push_back(solver.run(beta0, beta1, Ns, i));
+    }
   }
 
   // stop timer
@@ -131,12 +212,21 @@ int main(int argc, char* argv[])
   std::chrono::duration<double> elapsed_seconds = end_calc-start_calc;
   std::cout << "Calculation time: " << elapsed_seconds.count() << "s\n";
 
+  solver_stats total_stats;
+  for (auto &r : x) {
+    total_stats += r.stats_;
+  }
+  std::cout << "CSVStats , total, " << total_stats << std::endl;
+
   // start timer
   start_io = std::chrono::system_clock::now();
 
-  // Write out vector to file 
+  // Write out vector to file, remapping spins to the input labels if requested
   // @TODO, make each task write out it's own results or collect?
-  std::copy(x.begin(), x.end(), std::ostream_iterator<sa_solver::result_type>(out));
+  result_writer writer(H, format);
+  for (auto &r : x) {
+    writer(out, r);
+  }
   out.close();
 
   // stop timer
@@ -0,0 +1,111 @@
+#include "solver_stats.hpp"
+
+#ifdef SPINSOLVE_WITH_PERF_EVENTS
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+std::ostream& operator << (std::ostream& os, solver_stats const& stats)
+{
+  const double proposals(stats.proposals ? double(stats.proposals) : 1.0);
+  os << "repetitions, "     << stats.repetitions
+     << ", sweeps, "        << stats.sweeps
+     << ", proposals, "     << stats.proposals
+     << ", accepted, "      << stats.accepted
+     << ", acceptance, "    << stats.accepted/proposals
+     << ", nfold_sweeps, "  << stats.nfold_sweeps
+     << ", frozen, "        << stats.frozen
+     << ", polish_flips, "  << stats.polish_flips
+     << ", restarts, "      << stats.restarts
+     << ", delta_time, "    << stats.delta_ns*1e-9
+     << ", rng_time, "      << stats.rng_ns*1e-9
+     << ", result_time, "   << stats.result_ns*1e-9
+     << ", cycles, "        << stats.cycles
+     << ", cache_misses, "  << stats.cache_misses
+     << ", branch_misses, " << stats.branch_misses;
+  return os;
+}
+
+#ifdef SPINSOLVE_WITH_PERF_EVENTS
+
+namespace {
+
+// one set of event descriptors per OS thread, opened on first use
+struct perf_events
+{
+  int fd_[3];
+
+  perf_events() {
+    const std::uint64_t configs[3] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for (int i=0; i<3; ++i) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.type           = PERF_TYPE_HARDWARE;
+      attr.size           = sizeof(attr);
+      attr.config         = configs[i];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv     = 1;
+      fd_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    if (fd_[0] < 0) {
+      static bool warned = false;
+      if (!warned) {
+        warned = true;
+        std::cerr << "warning: perf_event_open failed, hardware counters disabled "
+                  << "(check /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+      }
+    }
+  }
+
+  ~perf_events() {
+    for (int i=0; i<3; ++i)
+      if (fd_[i] >= 0) close(fd_[i]);
+  }
+
+  std::uint64_t read_event(int i) const {
+    std::uint64_t value(0);
+    if (fd_[i] >= 0 && read(fd_[i], &value, sizeof(value)) != sizeof(value))
+      value = 0;
+    return value;
+  }
+};
+
+perf_events& thread_events()
+{
+  thread_local perf_events events;
+  return events;
+}
+
+}
+
+hardware_counters::hardware_counters()
+{
+  perf_events& events = thread_events();
+  for (int i=0; i<3; ++i)
+    start_[i] = events.read_event(i);
+}
+
+void hardware_counters::stop(solver_stats& stats)
+{
+  perf_events& events = thread_events();
+  stats.cycles        += events.read_event(0) - start_[0];
+  stats.cache_misses  += events.read_event(1) - start_[1];
+  stats.branch_misses += events.read_event(2) - start_[2];
+}
+
+#else
+
+hardware_counters::hardware_counters()
+{
+}
+
+void hardware_counters::stop(solver_stats&)
+{
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef SOLVER_STATS_HPP
+#define SOLVER_STATS_HPP
+
+#include <cstdint>
+#include <chrono>
+#include <iostream>
+
+/// counters collected by a solver during one repetition, summed up per
+/// locality by the solver wrapper and per run by the master
+struct solver_stats
+{
+  /// sweeps run, fewer than requested for runs that froze
+  std::uint64_t sweeps        = 0;
+  std::uint64_t proposals     = 0;
+  std::uint64_t accepted      = 0;
+
+  /// sweeps of the low temperature tail run by the rejection free kernel,
+  /// counted in sweeps and (as equivalent proposals) in proposals too
+  std::uint64_t nfold_sweeps  = 0;
+
+  /// repetitions that stopped before the last sweep because they froze
+  std::uint64_t frozen        = 0;
+
+  /// flips made by the local search after the anneal
+  std::uint64_t polish_flips  = 0;
+
+  /// restarts of the tabu search from its best configuration
+  std::uint64_t restarts      = 0;
+
+  /// nanoseconds spent in the energy change, the random numbers (Metropolis test)
+  /// and collecting the result, only measured when SPINSOLVE_INSTRUMENT_PHASES is set
+  std::uint64_t delta_ns      = 0;
+  std::uint64_t rng_ns        = 0;
+  std::uint64_t result_ns     = 0;
+
+  /// hardware events of the solving thread, only counted when
+  /// SPINSOLVE_WITH_PERF_EVENTS is set and the kernel allows it
+  std::uint64_t cycles        = 0;
+  std::uint64_t cache_misses  = 0;
+  std::uint64_t branch_misses = 0;
+
+  /// number of repetitions summed into this object
+  std::uint64_t repetitions   = 0;
+
+  solver_stats& operator += (const solver_stats& other)
+  {
+    sweeps        += other.sweeps;
+    proposals     += other.proposals;
+    accepted      += other.accepted;
+    nfold_sweeps  += other.nfold_sweeps;
+    frozen        += other.frozen;
+    polish_flips  += other.polish_flips;
+    restarts      += other.restarts;
+    delta_ns      += other.delta_ns;
+    rng_ns        += other.rng_ns;
+    result_ns     += other.result_ns;
+    cycles        += other.cycles;
+    cache_misses  += other.cache_misses;
+    branch_misses += other.branch_misses;
+    repetitions   += other.repetitions;
+    return *this;
+  }
+
+  template <typename Archive>
+  void serialize(Archive & ar, unsigned)
+  {
+      ar & sweeps & proposals & accepted & nfold_sweeps & frozen & polish_flips & restarts;
+      ar & delta_ns & rng_ns & result_ns;
+      ar & cycles & cache_misses & branch_misses;
+      ar & repetitions;
+  }
+};
+
+/// comma separated name, value pairs in the style of the CSVData lines
+std::ostream& operator << (std::ostream&, solver_stats const&);
+
+/// Adds the time spent in its scope to a counter when phase instrumentation
+/// is compiled in, and is an empty object otherwise so that the sweeps pay nothing.
+#ifdef SPINSOLVE_INSTRUMENT_PHASES
+class phase_timer
+{
+public:
+  explicit phase_timer(std::uint64_t& counter)
+    : counter_(counter), start_(std::chrono::steady_clock::now()) {}
+  ~phase_timer() {
+    counter_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+  }
+private:
+  std::uint64_t& counter_;
+  std::chrono::steady_clock::time_point start_;
+};
+#else
+class phase_timer
+{
+public:
+  explicit phase_timer(std::uint64_t&) {}
+};
+#endif
+
+/// Hardware event counters (cycles, cache misses, branch misses) of the calling
+/// thread between construction and stop(). Uses Linux perf_event when
+/// SPINSOLVE_WITH_PERF_EVENTS is set, otherwise it does nothing.
+class hardware_counters
+{
+public:
+  hardware_counters();
+  void stop(solver_stats&);
+private:
+  std::uint64_t start_[3];
+};
+
+#endif
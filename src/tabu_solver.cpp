@@ -0,0 +1,312 @@
+#include "tabu_solver.hpp"
+#include "sa_kernel.hpp"
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace {
+
+const unsigned no_spin = ~0u;
+
+// the most buckets a move_buckets object uses
+const std::size_t max_buckets = 1024;
+
+// The spins that may flip, in buckets of their energy change dE so that the
+// best move is the lowest non empty bucket. With integer fields of small
+// range every bucket holds one value of dE, otherwise a bucket covers a range
+// of values and the lowest one is scanned for its best spin.
+template <typename Field>
+class move_buckets
+{
+public:
+  move_buckets(const std::size_t N, const Field max_delta)
+    : offset_(double(max_delta)), bucket_(N, no_spin), position_(N)
+  {
+    const double span(2*double(max_delta));
+    exact_ = std::is_integral<Field>::value && span < max_buckets;
+    members_.resize(exact_ ? std::size_t(span)+1 : max_buckets);
+    width_ = exact_ ? 1.0 : std::max(span, 1.0)/(max_buckets-1);
+    lowest_ = members_.size();
+  }
+
+  bool contains(const unsigned i) const {return bucket_[i] != no_spin;}
+
+  void insert(const unsigned i, const Field dE) {
+    const unsigned b(index(dE));
+    bucket_[i] = b;
+    position_[i] = members_[b].size();
+    members_[b].push_back(i);
+    lowest_ = std::min<std::size_t>(lowest_, b);
+  }
+
+  void erase(const unsigned i) {
+    std::vector<unsigned>& from(members_[bucket_[i]]);
+    const unsigned last(from.back());
+    from[position_[i]] = last;
+    position_[last] = position_[i];
+    from.pop_back();
+    bucket_[i] = no_spin;
+  }
+
+  // the energy change of spin i is now dE, ignored for spins not in a bucket
+  void update(const unsigned i, const Field dE) {
+    if(!contains(i) || index(dE) == bucket_[i]) return;
+    erase(i);
+    insert(i, dE);
+  }
+
+  void clear() {
+    for(auto& m : members_) m.clear();
+    std::fill(bucket_.begin(), bucket_.end(), no_spin);
+    lowest_ = members_.size();
+  }
+
+  // the spin with the lowest energy change, no_spin if there is none,
+  // delta(i) gives the current change of spin i
+  template <typename Delta>
+  unsigned best(Delta delta) {
+    while(lowest_ < members_.size() && members_[lowest_].empty()) ++lowest_;
+    if(lowest_ == members_.size()) return no_spin;
+    const std::vector<unsigned>& m(members_[lowest_]);
+    if(exact_) return m.back();
+    unsigned best(m[0]);
+    Field best_dE(delta(best));
+    for(std::size_t k = 1; k < m.size(); ++k){
+      const Field dE(delta(m[k]));
+      if(dE < best_dE){
+        best_dE = dE;
+        best = m[k];
+      }
+    }
+    return best;
+  }
+
+private:
+  unsigned index(const Field dE) const {
+    const double x((double(dE) + offset_)/width_);
+    return static_cast<unsigned>(std::min(double(members_.size()-1), std::max(x, 0.0)));
+  }
+
+  double offset_;
+  double width_;
+  bool exact_;
+  std::vector<std::vector<unsigned> > members_;
+  std::vector<unsigned> bucket_;
+  std::vector<unsigned> position_;
+  // no bucket below this one has members
+  std::size_t lowest_;
+};
+
+// Tabu search from the configuration in spins, returns the best energy found
+// and leaves its configuration in spins. A flipped spin leaves the buckets
+// for tenure iterations; it may still flip if that gives a new best energy
+// (aspiration). After stall_sweeps sweeps without a new best the search
+// restarts from the best configuration with restart_fraction of it randomised.
+template <typename Table, typename Generator>
+typename Table::field_type tabu_search(const Table& J,
+                                       std::vector<int>& spins,
+                                       const std::size_t iterations,
+                                       const tabu_options& options,
+                                       Generator& rng,
+                                       solver_stats& stats)
+{
+  typedef typename Table::field_type field_type;
+
+  const unsigned N(J.size());
+  std::vector<field_type> h;
+  field_type E(local_fields(J, spins, h));
+  if(N == 0) return E;
+
+  const std::size_t tenure(std::min<std::size_t>(N-1,
+      options.tenure ? options.tenure : std::min<std::size_t>(20, N/4)+1));
+  const std::size_t stall(options.stall_sweeps*N);
+  std::uniform_real_distribution<double> realnums(0.0, 1.0);
+
+  move_buckets<field_type> moves(N, J.max_delta_);
+  // tabu spins in the order they flipped, with the iteration they are free
+  std::deque<std::pair<unsigned, std::size_t> > tabu;
+  auto delta = [&](const unsigned j){return flip_delta(spins, h, j);};
+  auto update = [&](const unsigned j){moves.update(j, flip_delta(spins, h, j));};
+  auto fill = [&](){
+    moves.clear();
+    tabu.clear();
+    for(unsigned i = 0; i < N; ++i)
+      moves.insert(i, flip_delta(spins, h, i));
+  };
+  fill();
+
+  // the best configuration is copied only when the search is about to
+  // leave it (stale: spins is better than best_spins)
+  field_type best_E(E);
+  std::vector<int> best_spins(spins);
+  bool stale(false);
+  std::size_t last_best(0);
+  std::uint64_t flips(0);
+
+  for(std::size_t it = 0; it < iterations; ++it){
+    while(!tabu.empty() && tabu.front().second <= it){
+      moves.insert(tabu.front().first, delta(tabu.front().first));
+      tabu.pop_front();
+    }
+
+    unsigned i(moves.best(delta));
+    field_type dE(i == no_spin ? field_type(0) : delta(i));
+    bool aspiration(false);
+    for(const auto& t : tabu){
+      const field_type d(delta(t.first));
+      if(E + d < best_E && (i == no_spin || d < dE)){
+        i = t.first;
+        dE = d;
+        aspiration = true;
+      }
+    }
+    if(i == no_spin) break;
+
+    if(stale && dE >= 0){
+      best_spins = spins;
+      stale = false;
+    }
+    if(aspiration){
+      for(auto t = tabu.begin(); t != tabu.end(); ++t)
+        if(t->first == i){
+          tabu.erase(t);
+          break;
+        }
+    }
+    else
+      moves.erase(i);
+
+    flip_spin(J, spins, h, i);
+    E += dE;
+    ++flips;
+    for_each_neighbour(J, i, update);
+    tabu.push_back(std::make_pair(i, it+1+tenure));
+
+    if(E < best_E){
+      best_E = E;
+      stale = true;
+      last_best = it;
+    }
+    else if(stall && it - last_best >= stall){
+      if(stale){
+        best_spins = spins;
+        stale = false;
+      }
+      spins = best_spins;
+      for(unsigned j = 0; j < N; ++j)
+        if(realnums(rng) < options.restart_fraction)
+          spins[j] ^= 1;
+      E = local_fields(J, spins, h);
+      fill();
+      last_best = it;
+      ++stats.restarts;
+    }
+  }
+
+  if(stale)
+    best_spins = spins;
+  spins.swap(best_spins);
+
+  stats.sweeps    += iterations/N;
+  stats.proposals += iterations;
+  stats.accepted  += flips;
+
+  return best_E;
+}
+
+template <typename Table>
+class tabu_kernel_impl : public tabu_kernel
+{
+public:
+  tabu_kernel_impl(const hamiltonian_type& H, const std::string& name)
+    : J_(H), name_(name) {}
+
+  double search(std::vector<int>& spins,
+                const std::size_t iterations,
+                const tabu_options& options,
+                generator_type& rng,
+                solver_stats& stats) const
+  {
+    return tabu_search(J_, spins, iterations, options, rng, stats);
+  }
+
+  std::string name() const {return name_;}
+
+private:
+  Table J_;
+  std::string name_;
+};
+
+}
+
+std::shared_ptr<const tabu_kernel> make_tabu_kernel(const hamiltonian_type& H)
+{
+  if(integer_couplings_fit(H))
+    return std::make_shared<tabu_kernel_impl<integer_couplings> >(H, "tabu/int16/general");
+  else
+    return std::make_shared<tabu_kernel_impl<real_couplings> >(H, "tabu/double/general");
+}
+
+tabu_solver::tabu_solver(const hamiltonian_type& H, const tabu_options& options)
+  : N_(H.size()), options_(options)
+{
+  H_ = std::make_shared<hamiltonian_type>(H);
+  kernel_ = make_tabu_kernel(H);
+}
+
+tabu_solver tabu_solver::clone() const
+{
+  tabu_solver copy;
+  copy.N_ = N_;
+  copy.options_ = options_;
+  copy.warm_ = warm_;
+  if (H_) {
+    copy.H_ = std::make_shared<hamiltonian_type>(*H_);
+    copy.kernel_ = make_tabu_kernel(*copy.H_);
+  }
+  return copy;
+}
+
+void tabu_solver::set_warm_start(std::shared_ptr<const warm_start> warm)
+{
+  if (warm && warm->empty()) warm.reset();
+  if (warm) warm->check(N_);
+  warm_ = warm;
+}
+
+result tabu_solver::run(
+                    const double /* beta0 */
+                    , const double /* beta1 */
+                    , const std::size_t Ns
+                    , const std::size_t seed
+                    )
+{
+  std::minstd_rand0 linear_congruential_generator;
+  linear_congruential_generator.seed(seed);
+
+  std::uniform_int_distribution<int> binaries(0, 1);
+  std::vector<int> spins;
+  spins.reserve(N_);
+  if(warm_)
+    warm_->initial(spins, seed, linear_congruential_generator);
+  else
+    for(unsigned i = 0; i < N_; ++i)
+      spins.push_back(binaries(linear_congruential_generator));
+
+  result res;
+  res.stats_.repetitions = 1;
+  res.seed_ = seed;
+
+  double E(0.0);
+  if (kernel_) {
+    hardware_counters hw;
+    E = kernel_->search(spins, Ns*N_, options_, linear_congruential_generator, res.stats_);
+    hw.stop(res.stats_);
+  }
+
+  res.E_ = E;
+  res.spins_.swap(spins);
+  return res;
+}
@@ -0,0 +1,103 @@
+#ifndef TABU_SOLVER_HPP
+#define TABU_SOLVER_HPP
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "hamiltonian.hpp"
+#include "result.hpp"
+#include "solver_stats.hpp"
+#include "warm_start.hpp"
+
+// Tuning of the tabu search
+struct tabu_options
+{
+  // iterations a flipped spin may not flip back, 0 picks min(20, N/4)+1
+  std::size_t tenure = 0;
+
+  // restart after this many sweeps (N iterations) without a new best
+  // configuration (0 never restarts)
+  std::size_t stall_sweeps = 10;
+
+  // fraction of the spins of the best configuration randomised on a restart
+  double restart_fraction = 0.1;
+
+  template <typename Archive>
+  void serialize(Archive & ar, unsigned)
+  {
+      ar & tenure & stall_sweeps & restart_fraction;
+  }
+};
+
+// Tabu search on the coupling tables of sa_kernel.hpp, one instance is built
+// per hamiltonian and shared (read only) by all the solver copies running on it
+class tabu_kernel
+{
+public:
+  typedef std::minstd_rand0 generator_type;
+
+  virtual ~tabu_kernel() {}
+
+  // search from the configuration in spins for the given number of single
+  // flip iterations, leaves the best configuration found in spins and
+  // returns its energy
+  virtual double search(std::vector<int>& spins,
+                        const std::size_t iterations,
+                        const tabu_options& options,
+                        generator_type& rng,
+                        solver_stats& stats) const = 0;
+
+  // short description of the storage, e.g. "int16/general"
+  virtual std::string name() const = 0;
+};
+
+std::shared_ptr<const tabu_kernel> make_tabu_kernel(const hamiltonian_type& H);
+
+class tabu_solver
+// Tabu search for the ground state of the spin glass, an alternative to
+// sa_solver with the same interface so that it can be wrapped and spawned
+// in the same way. Every iteration flips the spin with the lowest energy
+// change that is not tabu (or that gives a new best energy), the spins are
+// kept in buckets by their energy change so the best move is found without
+// scanning all of them.
+//
+// run(...) starts from a random configuration (or a warm start state), the
+// temperatures are ignored and Ns sweeps are Ns*N iterations
+{
+public:
+
+  typedef result result_type;
+  typedef tabu_options options_type;
+
+  // empty constructor required by HPX factory create function
+  tabu_solver() : N_(0) { };
+
+  tabu_solver(const hamiltonian_type&, const tabu_options& = tabu_options());
+
+  // single search from a random initial state
+  result run(const double, const double, const std::size_t, const std::size_t);
+
+  // deep copy with its own hamiltonian and coupling tables, allocated by
+  // the calling thread (first touch, for one replica per NUMA domain)
+  tabu_solver clone() const;
+
+  void set_options(const tabu_options& options) { options_ = options; }
+  const tabu_options& options() const { return options_; }
+
+  // as sa_solver::set_warm_start
+  void set_warm_start(std::shared_ptr<const warm_start>);
+
+  // name of the kernel selected for the hamiltonian
+  std::string kernel_name() const { return kernel_ ? kernel_->name() : "none"; }
+
+private:
+
+  std::size_t N_;
+  std::shared_ptr<hamiltonian_type> H_;
+  std::shared_ptr<const tabu_kernel> kernel_;
+  tabu_options options_;
+  std::shared_ptr<const warm_start> warm_;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include "warm_start.hpp"
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+void warm_start::check(const std::size_t N) const
+{
+  for(const auto& s : states)
+    if(s.size() != N)
+      throw std::invalid_argument("warm start state of " + std::to_string(s.size())
+                                  + " spins for " + std::to_string(N) + " spins");
+}
+
+warm_start make_warm_start(const std::vector<result>& results, const std::size_t K, const double randomise)
+{
+  std::vector<const result*> sorted;
+  sorted.reserve(results.size());
+  for(const auto& r : results)
+    sorted.push_back(&r);
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const result* a, const result* b){return a->E_ < b->E_;});
+
+  warm_start ws;
+  ws.randomise = randomise;
+  std::set<std::vector<int> > seen;
+  for(const auto r : sorted){
+    if(K && ws.states.size() == K) break;
+    if(seen.insert(r->spins_).second)
+      ws.states.push_back(r->spins_);
+  }
+  return ws;
+}
@@ -0,0 +1,49 @@
+#ifndef WARM_START_HPP
+#define WARM_START_HPP
+
+#include <cstddef>
+#include <random>
+#include <vector>
+#include "result.hpp"
+
+/// Initial configurations for warm started runs. Instead of random spins the
+/// run with seed s starts from states[s % states.size()] with each spin
+/// flipped with probability randomise. Started at an intermediate beta0 the
+/// anneal refines the state (reverse annealing) in a fraction of the sweeps
+/// a run from random spins needs.
+struct warm_start
+{
+  /// the configurations, in solver order
+  std::vector<std::vector<int> > states;
+
+  /// fraction of the spins flipped before a run
+  double randomise = 0.0;
+
+  bool empty() const {return states.empty();}
+
+  /// throws std::invalid_argument unless every state has N spins
+  void check(std::size_t N) const;
+
+  /// the initial spins of the run with the given seed
+  template <typename Generator>
+  void initial(std::vector<int>& spins, const std::size_t seed, Generator& rng) const
+  {
+    spins = states[seed % states.size()];
+    if(randomise <= 0.0) return;
+    std::uniform_real_distribution<double> realnums(0.0, 1.0);
+    for(auto& s : spins)
+      if(realnums(rng) < randomise)
+        s ^= 1;
+  }
+
+  template <typename Archive>
+  void serialize(Archive & ar, unsigned)
+  {
+      ar & states & randomise;
+  }
+};
+
+/// the configurations of the K lowest energy distinct results (all if K is 0)
+warm_start make_warm_start(const std::vector<result>&, std::size_t K, double randomise = 0.0);
+
+#endif